@@ -0,0 +1,21 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file COBS.h
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef  __COBS_H__
+#define __COBS_H__
+
+	#include "common.h"
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief the largest encoded size of length bytes. Doesn't include the
+	/// zero delimiter
+	///////////////////////////////////////////////////////////////////////////////
+	#define COBS_MAX_ENCODED_LENGTH(length) ((length) + ((length) / 254) + 1)
+
+	uint32_t COBS_Encode(const uint8_t *source, uint32_t length, uint8_t *destination);
+	uint32_t COBS_Decode(const uint8_t *source, uint32_t length, uint8_t *destination);
+
+#endif /* __COBS_H__ */
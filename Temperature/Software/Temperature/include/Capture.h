@@ -0,0 +1,51 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file Capture.h
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef  __CAPTURE_H__
+#define __CAPTURE_H__
+
+	#include "common.h"
+	#include "MCU/adc.h"
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define the trigger types
+	///////////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		CaptureTrigger_Rising = 0,		///< the channel goes from below the level to at or above it
+		CaptureTrigger_Falling,			///< the channel goes from above the level to at or below it
+		CaptureTrigger_Slope,			///< the channel moves by the level or more from one vector to the next
+	} CaptureTriggerType;
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define the capture states
+	///////////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		CaptureState_Idle = 0,		///< not capturing
+		CaptureState_Armed,			///< keeping the pre trigger history and waiting for the trigger
+		CaptureState_Triggered,		///< taking the post trigger vectors
+		CaptureState_Done,			///< the capture is frozen and can be read
+	} CaptureStateType;
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define a frozen capture
+	///////////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		const uint16_t	*Samples;			///< the scan vectors, oldest first. One sample per channel in channel number order
+		uint32_t		NumberOfVectors;	///< number of vectors
+		uint32_t		NumberOfChannels;	///< number of samples in each vector
+		uint32_t		TriggerVector;		///< the vector that fired the trigger. The vectors before it are the pre trigger history
+		uint32_t		TimestampMs;		///< timestamp of the block the trigger fired in
+		uint64_t		TimestampUs;		///< the same in micro-seconds
+	} CaptureType;
+
+	void Capture_Init(void);
+	uint32_t Capture_GetBufferSize(void);
+	uint_fast8_t Capture_Arm(uint32_t triggerIndex, CaptureTriggerType trigger, uint32_t level, uint32_t preVectors, uint32_t postVectors);
+	void Capture_Stop(void);
+	CaptureStateType Capture_GetState(void);
+	int_fast8_t Capture_Get(CaptureType *destination);
+
+#endif /* __CAPTURE_H__ */
@@ -0,0 +1,33 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file Decimator.h
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef  __DECIMATOR_H__
+#define __DECIMATOR_H__
+
+	#include "common.h"
+	#include "MCU/adc.h"
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief the largest decimation. 2 to the power of this
+	///////////////////////////////////////////////////////////////////////////////
+	#define DECIMATOR_MAX_SHIFT 12
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define a decimated scan vector
+	///////////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		uint32_t Values[ADC_NUMBER_OF_CHANNELS];	///< one value per channel. 12 + shift / 2 bits
+		uint32_t NumberOfValues;					///< number of channels
+		uint32_t TimestampMs;						///< timestamp of the block the last sample came from
+	} DecimatorOutputType;
+
+	uint_fast8_t Decimator_Start(uint32_t shift);
+	void Decimator_Stop(void);
+	int_fast8_t Decimator_Read(DecimatorOutputType *destination);
+	uint_fast8_t Decimator_IsOutputPending(void);
+	uint32_t Decimator_GetOverflowCount(void);
+
+#endif /* __DECIMATOR_H__ */
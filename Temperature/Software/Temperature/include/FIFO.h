@@ -7,9 +7,35 @@
 #ifndef  __FIFO_H__
 #define __FIFO_H__
 
-	void FIFO_Initialiser(void);
-	uint32_t FIFO_CounnterBufferCount(void);
-	uint_fast8_t FIFO_Write(uint8_t inputData);
-	uint_fast8_t FIFO_Read(uint8_t *outputDataPointer);
+	#include "common.h"
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define a single producer / single consumer fifo.
+	///
+	///	The writer only ever moves WritePosition and the reader only ever moves
+	///	ReadPosition. Both positions are free running and masked when used as
+	///	an index, so no shared counter is needed and the fifo can be written from
+	///	an interrupt and read from the main loop without disabling interrupts.
+	///
+	///	\note Do not modify the members directly. Use FIFO_Initialiser
+	///////////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		uint8_t				*Buffer;		///< the fifo storage. Provided by the owner
+		uint32_t			Mask;			///< buffer size - 1. The size must be a power of two
+		volatile uint32_t	WritePosition;	///< free running write position. Only modified by the writer
+		volatile uint32_t	ReadPosition;	///< free running read position. Only modified by the reader
+	} FIFO_Type;
+
+	int_fast8_t FIFO_Initialiser(FIFO_Type *fifo, uint8_t *buffer, uint32_t size);
+	uint32_t FIFO_CounnterBufferCount(const FIFO_Type *fifo);
+	uint32_t FIFO_FreeSpace(const FIFO_Type *fifo);
+	uint_fast8_t FIFO_Write(FIFO_Type *fifo, uint8_t inputData);
+	int_fast8_t FIFO_Read(FIFO_Type *fifo, uint8_t *outputDataPointer);
+	uint32_t FIFO_WriteBlock(FIFO_Type *fifo, const uint8_t *source, uint32_t length);
+	uint32_t FIFO_ReadBlock(FIFO_Type *fifo, uint8_t *destination, uint32_t length);
+	uint32_t FIFO_PeekWrite(FIFO_Type *fifo, uint8_t **destination);
+	uint_fast8_t FIFO_CommitWrite(FIFO_Type *fifo, uint32_t length);
+	uint32_t FIFO_PeekRead(FIFO_Type *fifo, uint8_t **source);
+	uint_fast8_t FIFO_CommitRead(FIFO_Type *fifo, uint32_t length);
 
 #endif /* __FIFO_H__ */
@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file History.h
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef  __HISTORY_H__
+#define __HISTORY_H__
+
+	#include "common.h"
+	#include "MCU/adc.h"
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief the largest statistics window in samples
+	///////////////////////////////////////////////////////////////////////////////
+	#define HISTORY_MAX_WINDOW 128
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief the most scan vectors averaged into one sample. 2 to the power
+	/// of this
+	///////////////////////////////////////////////////////////////////////////////
+	#define HISTORY_MAX_SHIFT 12
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define the statistics of a window of the history. Centi-degrees
+	///////////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		uint32_t	NumberOfSamples;	///< samples in the window. Less than asked for until the history has filled
+		int32_t		Mean;				///< the mean
+		int32_t		Minimum;			///< the lowest sample
+		int32_t		Maximum;			///< the highest sample
+		int32_t		StandardDeviation;	///< the population standard deviation
+		int32_t		Latest;				///< the newest sample
+	} HistoryStatsType;
+
+	uint_fast8_t History_Start(uint32_t shift);
+	void History_Stop(void);
+	void History_Process(void);
+	uint32_t History_GetIdleMs(void);
+	uint32_t History_GetNumberOfSamples(void);
+	int_fast8_t History_GetStats(uint32_t window, HistoryStatsType *destination);
+
+#endif /* __HISTORY_H__ */
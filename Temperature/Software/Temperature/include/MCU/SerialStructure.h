@@ -23,6 +23,14 @@
         uint_fast8_t    (*SendArray) (const uint8_t *source, uint32_t length); ///< send an array of data
         int_fast8_t     (*DoesReceiveBufferHaveData)(void);                    ///< return the state of the serial receive buffer
         int_fast8_t     (*GetByte) (uint8_t *destination);                     ///< get a single byte from the serial
+        uint32_t        (*GetArray) (uint8_t *destination, uint32_t length);   ///< get up to length bytes from the serial. return the number of bytes read
+        uint32_t        (*GetTransmitFreeSpace)(void);                         ///< return how many bytes can be sent without being rejected
+        uint_fast8_t    (*IsTransmitBusy)(void);                               ///< return true until all the queued data has left the port
+        uint_fast8_t    (*SendArrayInPlace) (const uint8_t *source, uint32_t length); ///< send an array without copying it. The data must stay valid until sent
+        uint_fast8_t    (*SetBaudrate)(const uint32_t baudrate);               ///< change the baudrate of an open port. Wait for the transmit to finish first
+        uint32_t        (*GetActualBaudrate)(const uint32_t baudrate);         ///< return the baudrate really achieved for a desired baudrate. 0 = not possible
+        uint32_t        (*GetReceiveOverflowCount)(void);                      ///< return how many times received data was lost because it wasn't read in time
+        uint32_t        (*GetTransmitFreeDescriptors)(void);                   ///< return how many more sends can be queued. Each send takes at most one
     }SerialInterface;
 
 #endif
@@ -8,11 +8,184 @@
 
 	#include "common.h"
 
-	void ADC_On(void);
-	void ADC_Off(void);
-	uint_fast8_t ADC_Read(uint_fast32_t channel, uint_fast16_t * destination);
-	uint_fast8_t ADC_ReadNorm(uint_fast32_t channel, float * destination);
-	float ADC_ReturnCalibratedTemperature(uint_fast16_t rawData);
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief number of ADC channels. 0 to 15 are the pins
+	/////////////////////////////////////////////////////////////////////////
+	#define ADC_NUMBER_OF_CHANNELS 18
 
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief the internal temperature sensor channel
+	/////////////////////////////////////////////////////////////////////////
+	#define ADC_TEMPERATURE_CHANNEL 16
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief the internal reference voltage channel
+	/////////////////////////////////////////////////////////////////////////
+	#define ADC_VREFINT_CHANNEL 17
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief the largest 12 bit sample
+	/////////////////////////////////////////////////////////////////////////
+	#define ADC_MAX_SAMPLE 4095
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief the most channels ADC_Convert converts in one go
+	/////////////////////////////////////////////////////////////////////////
+	#define ADC_MAX_CONVERSION_CHANNELS 4
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief the most block handlers the scan calls
+	/////////////////////////////////////////////////////////////////////////
+	#define ADC_MAX_BLOCK_HANDLERS 4
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines the sampling times in ADC clocks. The values are the
+	/// SMP bits
+	/////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		ADCSampleTime_1_5 = 0,	///< 1.5 clocks
+		ADCSampleTime_7_5,		///< 7.5 clocks
+		ADCSampleTime_13_5,		///< 13.5 clocks
+		ADCSampleTime_28_5,		///< 28.5 clocks
+		ADCSampleTime_41_5,		///< 41.5 clocks
+		ADCSampleTime_55_5,		///< 55.5 clocks
+		ADCSampleTime_71_5,		///< 71.5 clocks. The least the temperature sensor and VREFINT take
+		ADCSampleTime_239_5,	///< 239.5 clocks
+	} ADCSampleTimeType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines the resolutions. The values are the RES bits
+	/////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		ADCResolution_12Bit = 0,	///< 12 bits. 12.5 clocks to convert
+		ADCResolution_10Bit,		///< 10 bits. 10.5 clocks to convert
+		ADCResolution_8Bit,			///< 8 bits. 8.5 clocks to convert
+		ADCResolution_6Bit,			///< 6 bits. 6.5 clocks to convert
+	} ADCResolutionType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines the sample alignments in the 16 bit data
+	/////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		ADCAlign_Right = 0,		///< in the low bits
+		ADCAlign_Left,			///< in the high bits. The 6 bit samples are in the high bits of the low byte
+	} ADCAlignType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines how a channel is converted.
+	///
+	///	The ADC has one sampling time, resolution and alignment for all the
+	///	channels. So a scan or conversion of several channels uses the
+	///	longest sampling time, the most bits, and left alignment only when
+	///	every channel asks for it.
+	/////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		ADCSampleTimeType	SampleTime;		///< the sampling time
+		ADCResolutionType	Resolution;		///< the resolution
+		ADCAlignType		Alignment;		///< the alignment
+	} ADCProfileType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines the ADC states
+	/////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		ADCState_Off = 0,		///< off
+		ADCState_Calibrating,	///< turning on. Offset calibration running
+		ADCState_Enabling,		///< turning on. Waiting for the ADC to be ready
+		ADCState_Ready,			///< on and ready to convert
+		ADCState_Disabling,		///< turning off
+		ADCState_Resolving,		///< changing the resolution. Disabled and enabled again
+		ADCState_Error,			///< a step timed out. The ADC has been reset
+	} ADCStateType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief called from the ADC interrupt when an ADC_Convert conversion
+	/// is complete.
+	///
+	///	\param samples one sample per channel in channel number order
+	///	\param numberOfSamples number of samples
+	/////////////////////////////////////////////////////////////////////////
+	typedef void (*ADCConversionHandlerType)(const uint16_t *samples, uint32_t numberOfSamples);
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines the watchdog alarm states
+	/////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		ADCAlarm_Off = 0,		///< inside the window
+		ADCAlarm_High,			///< went above the window
+		ADCAlarm_Low,			///< went below the window
+	} ADCAlarmStateType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines the watchdog alarm
+	/////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		ADCAlarmStateType	State;			///< the alarm state
+		uint32_t			TimestampMs;	///< Tick_GetMs of the last change
+		uint32_t			ChangeCount;	///< counts the changes. A jump of more than one means some were missed
+	} ADCAlarmType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines how the scan conversions are started
+	/////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		ADCScanMode_Continuous = 0,		///< scan again as soon as a scan ends
+		ADCScanMode_Software,			///< one scan per ADC_Scan_Trigger call
+		ADCScanMode_Timer,				///< one scan per timer tick. See ADC_Scan_SetRate
+	} ADCScanModeType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief Defines a block of scan vectors. The DMA fills one block while
+	/// the other is handed out, so a block stays untouched until the next one
+	/// is complete.
+	/////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		const uint16_t	*Samples;			///< one sample per channel in channel number order for each vector
+		uint32_t		NumberOfVectors;	///< number of vectors in the block
+		uint32_t		NumberOfChannels;	///< number of samples in each vector
+		uint32_t		ChannelMask;		///< bit n set = channel n is in the vector
+		uint32_t		TimestampMs;		///< Tick_GetMs when the last vector was converted
+		uint64_t		TimestampUs;		///< Tick_GetUs when the last vector was converted
+		uint32_t		Sequence;			///< counts the blocks. A gap means blocks were missed
+	} ADCBlockType;
+
+	/////////////////////////////////////////////////////////////////////////
+	/// \brief called at PendSV priority every time a block of scan vectors
+	/// is complete. Deferred from the DMA interrupt.
+	///
+	///	\param block the complete block
+	/////////////////////////////////////////////////////////////////////////
+	typedef void (*ADCBlockHandlerType)(const ADCBlockType *block);
+
+	uint_fast8_t ADC_On(void);
+	uint_fast8_t ADC_Off(void);
+	void ADC_Process(void);
+	ADCStateType ADC_GetState(void);
+	uint32_t ADC_GetIdleMs(void);
+	int_fast8_t ADC_SetProfile(uint32_t channel, const ADCProfileType *profile);
+	int_fast8_t ADC_GetProfile(uint32_t channel, ADCProfileType *destination);
+	uint32_t ADC_ReturnMaxScanRate(uint32_t channelMask);
+	uint_fast8_t ADC_Convert(uint32_t channelMask, ADCConversionHandlerType handler);
+	int_fast8_t ADC_GetConversion(uint16_t *destination);
+	void ADC_CancelConversion(void);
+	uint32_t ADC_ReturnNormalised(uint_fast16_t rawData);
+	int32_t ADC_ReturnCalibratedTemperature(uint_fast16_t rawData);
+	uint32_t ADC_ReturnSupplyFactor(uint_fast16_t vrefintData);
+	uint32_t ADC_ReturnSupplyMillivolts(uint32_t supplyFactor);
+	int32_t ADC_ReturnCompensatedTemperature(uint_fast16_t rawData, uint32_t supplyFactor);
+
+	uint_fast8_t ADC_Scan_Start(uint32_t channelMask, ADCScanModeType mode);
+	void ADC_Scan_Stop(void);
+	uint_fast8_t ADC_Scan_Trigger(void);
+	uint32_t ADC_Scan_SetRate(uint32_t rate);
+	uint32_t ADC_Scan_GetLatest(uint16_t *destination);
+	uint32_t ADC_Scan_GetChannelCount(void);
+	uint32_t ADC_Scan_GetChannelMask(void);
+	int_fast8_t ADC_Scan_AddBlockHandler(ADCBlockHandlerType handler);
+	void ADC_Scan_RemoveBlockHandler(ADCBlockHandlerType handler);
+
+	uint_fast8_t ADC_Watchdog_Start(uint32_t channel, uint32_t low, uint32_t high, uint32_t hysteresis);
+	void ADC_Watchdog_Stop(void);
+	int_fast8_t ADC_Watchdog_GetAlarm(ADCAlarmType *destination);
 
 #endif
@@ -0,0 +1,14 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file crc.h
+/// Author: Ronald Sousa (@Opticalworm)
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CRC_H__
+#define __CRC_H__
+
+	#include "common.h"
+
+	void CRC32_Init(void);
+	uint32_t CRC32_Calculate(const uint8_t *source, uint32_t length);
+
+#endif
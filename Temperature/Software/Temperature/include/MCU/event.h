@@ -0,0 +1,48 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file event.h
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef  __EVENT_H__
+#define __EVENT_H__
+
+	#include "common.h"
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define the events handled in the main loop. Highest priority
+	/// first
+	///////////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		Event_Receive = 0,		///< serial data received
+		Event_Transmit,			///< a serial transmit finished
+		Event_Conversion,		///< an ADC conversion finished or the alarm changed
+		Event_Scan,				///< a scan block has been through the block handlers
+		Event_Tick,				///< a tick passed
+		Event_Poll,				///< a module is waiting on something that has no interrupt
+		EVENT_NUMBER_OF_EVENTS
+	} EventType;
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define the work deferred from an interrupt to PendSV. Highest
+	/// priority first
+	///////////////////////////////////////////////////////////////////////////////
+	typedef enum {
+		EventDeferred_ScanBlock = 0,	///< run the ADC block handlers
+		EVENT_NUMBER_OF_DEFERRED
+	} EventDeferredType;
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define an event handler
+	///////////////////////////////////////////////////////////////////////////////
+	typedef void (*EventHandlerType)(void);
+
+	void Event_Init(void);
+	void Event_SetHandler(EventType event, EventHandlerType handler);
+	void Event_Post(EventType event);
+	uint_fast8_t Event_IsPending(void);
+	uint_fast8_t Event_Dispatch(void);
+	void Event_SetDeferredHandler(EventDeferredType work, EventHandlerType handler);
+	void Event_Defer(EventDeferredType work);
+
+#endif /* __EVENT_H__ */
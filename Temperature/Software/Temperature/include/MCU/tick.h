@@ -16,10 +16,18 @@
         uint32_t DelayMs;       ///< Set the desire delay
     } TickType;
 
+    /////////////////////////////////////////////////////////////////////////
+    /// \brief no deadline. Returned by the *_GetIdleMs functions when
+    /// nothing needs the core at a set time
+    /////////////////////////////////////////////////////////////////////////
+    #define TICK_IDLE_FOREVER 0xFFFFFFFF
+
 
     void Tick_init(void);
     uint32_t Tick_GetMs(void);
+    uint64_t Tick_GetUs(void);
     int_fast8_t Tick_DelayMs_NonBlocking(uint_fast8_t reset, TickType * config);
     void Tick_DelayMs(uint32_t delayMs);
+    void Tick_Sleep(uint32_t idleMs);
 
 #endif
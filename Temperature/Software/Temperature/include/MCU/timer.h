@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file timer.h
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef  __TIMER_H__
+#define __TIMER_H__
+
+	#include "common.h"
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief number of slots in the timer wheel. Must be a power of 2
+	///////////////////////////////////////////////////////////////////////////////
+	#define TIMER_WHEEL_SIZE 32
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define the function called when a timer expires
+	///
+	///	\param context the pointer given to Timer_Start
+	///////////////////////////////////////////////////////////////////////////////
+	typedef void (*TimerCallbackType)(void *context);
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define a software timer. Owned by the caller, which must keep it
+	/// alive while it runs. Don't modify the members directly.
+	///////////////////////////////////////////////////////////////////////////////
+	typedef struct TimerStructure {
+		struct TimerStructure	*Next;			///< the next timer in the slot
+		struct TimerStructure	**Link;			///< the pointer that points to this timer. 0 = not running
+		uint32_t				ExpiryMs;		///< Tick_GetMs when it expires
+		uint32_t				PeriodMs;		///< the reload period. 0 = one shot
+		TimerCallbackType		Callback;		///< called in the main loop when it expires
+		void					*Context;		///< passed to the callback
+	} TimerType;
+
+	void Timer_Start(TimerType *timer, uint32_t delayMs, uint32_t periodMs, TimerCallbackType callback, void *context);
+	void Timer_Cancel(TimerType *timer);
+	uint_fast8_t Timer_IsRunning(const TimerType *timer);
+	void Timer_Process(void);
+	uint32_t Timer_GetIdleMs(void);
+
+#endif /* __TIMER_H__ */
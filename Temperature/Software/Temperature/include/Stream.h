@@ -0,0 +1,53 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file Stream.h
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef  __STREAM_H__
+#define __STREAM_H__
+
+	#include "common.h"
+	#include "MCU/adc.h"
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief the most samples in a subscription batch
+	///////////////////////////////////////////////////////////////////////////////
+	#define STREAM_MAX_BATCH 8
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief the highest subscription rate. One sample per tick
+	///////////////////////////////////////////////////////////////////////////////
+	#define STREAM_MAX_RATE 1000
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define a reported sample
+	///////////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		uint32_t Channel;		///< the ADC channel
+		uint32_t Value;			///< the sample
+		uint32_t TimestampMs;	///< Tick_GetMs when the sample was taken from the scan
+	} StreamSampleType;
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// \brief define a batch of subscribed samples due at the same time
+	///////////////////////////////////////////////////////////////////////////////
+	typedef struct {
+		uint32_t	Sequence;					///< counts the batches. A gap means a batch was dropped
+		uint32_t	TimestampMs;				///< Tick_GetMs when the samples were taken from the scan
+		uint32_t	NumberOfSamples;			///< number of samples
+		uint8_t		Channel[STREAM_MAX_BATCH];	///< the ADC channel of each sample
+		uint16_t	Value[STREAM_MAX_BATCH];	///< the samples
+	} StreamBatchType;
+
+	uint_fast8_t Stream_SetChannel(uint32_t channel, uint32_t deadband, uint32_t heartbeatMs);
+	void Stream_ClearChannel(uint32_t channel);
+	void Stream_Stop(void);
+	int_fast8_t Stream_Read(StreamSampleType *destination);
+	uint_fast8_t Stream_Subscribe(uint32_t channel, uint32_t rate);
+	void Stream_Unsubscribe(uint32_t channel);
+	void Stream_UnsubscribeAll(void);
+	int_fast8_t Stream_ReadBatch(StreamBatchType *destination);
+	uint32_t Stream_GetIdleMs(void);
+
+#endif /* __STREAM_H__ */
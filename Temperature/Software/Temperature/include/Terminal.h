@@ -9,5 +9,6 @@
 
 	void Terminal_Init(void);
 	uint_fast8_t Terminal_Process(void);
+	uint32_t Terminal_GetIdleMs(void);
 
 #endif // __TERMINAL_H__
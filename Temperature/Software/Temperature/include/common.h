@@ -29,6 +29,16 @@
 	/////////////////////////////////////////////////////////////////////////
 	#define ERROR_INVALID_POINTER 	-2
 
+	/////////////////////////////////////////////////////////////////////////
+	///	\brief	Stops the compiler and the core from reordering memory access
+	///	across this point. Used when data is shared between an interrupt and
+	///	the main loop without disabling interrupts.
+	///
+	///	\note the CMSIS __DMB() doesn't tell the compiler that memory has
+	///	changed, hence the memory clobber.
+	/////////////////////////////////////////////////////////////////////////
+	#define MEMORY_BARRIER() __ASM volatile ("dmb" : : : "memory")
+
     ///////////////////////////////////////////////////////////////////////////////
     /// \brief Firmware version
     /// D = development version of the firmware. Should only be used for testing purposes
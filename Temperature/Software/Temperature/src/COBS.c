@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file COBS.c
+///
+///	\brief Consistent Overhead Byte Stuffing
+///
+///	COBS removes every zero from a frame so a single zero can mark the end
+///	of it. A receiver that joins mid stream or sees a corrupt byte only has to
+///	wait for the next zero to be back in step. The cost is at most one byte
+///	every 254.
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+#include "COBS.h"
+
+////////////////////////////////////////////////////////
+///	\brief encode an array. The zero delimiter isn't added
+///
+///	\param source the data to encode
+///	\param length number of bytes to encode
+///	\param destination where to put the encoded data. Must hold
+///	COBS_MAX_ENCODED_LENGTH(length) bytes and not overlap the source
+///
+///	\return the encoded length
+////////////////////////////////////////////////////////
+uint32_t COBS_Encode(const uint8_t *source, uint32_t length, uint8_t *destination)
+{
+	uint32_t CodeIndex = 0;
+	uint32_t WriteIndex = 1;
+	uint8_t Code = 1;
+
+	while ( length-- )
+	{
+		if ( *source )
+		{
+			destination[WriteIndex++] = *source;
+			Code++;
+		}
+
+		// a zero or a full block of 254 bytes ends the block
+		if ( !*source || 0xFF == Code )
+		{
+			destination[CodeIndex] = Code;
+			CodeIndex = WriteIndex++;
+			Code = 1;
+		}
+
+		source++;
+	}
+
+	destination[CodeIndex] = Code;
+
+	return WriteIndex;
+}
+
+////////////////////////////////////////////////////////
+///	\brief decode an array without the zero delimiter
+///
+///	\param source the encoded data
+///	\param length number of encoded bytes
+///	\param destination where to put the decoded data. Can be the
+///	same as source to decode in place
+///
+///	\return the decoded length. 0 = the data isn't valid COBS
+////////////////////////////////////////////////////////
+uint32_t COBS_Decode(const uint8_t *source, uint32_t length, uint8_t *destination)
+{
+	uint32_t ReadIndex = 0;
+	uint32_t WriteIndex = 0;
+	uint8_t Code;
+	uint8_t Count;
+
+	while ( ReadIndex < length )
+	{
+		Code = source[ReadIndex++];
+
+		if ( !Code || (ReadIndex + Code - 1) > length )
+		{
+			return 0;
+		}
+
+		// the write index is always behind the read index so in place works
+		for ( Count = 1; Count < Code; Count++ )
+		{
+			destination[WriteIndex++] = source[ReadIndex++];
+		}
+
+		// every block but a full one and the last stands for a zero
+		if ( 0xFF != Code && ReadIndex < length )
+		{
+			destination[WriteIndex++] = 0;
+		}
+	}
+
+	return WriteIndex;
+}
@@ -0,0 +1,351 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file Capture.c
+///
+///	\brief Triggered capture of the ADC scan
+///
+///	Like an oscilloscope. While armed every scan vector goes into a circular
+///	buffer, so the vectors before the trigger are kept. Once the trigger
+///	fires the post trigger vectors are taken and the buffer is frozen until
+///	it is read and armed again.
+///
+///	The buffer is a fixed CAPTURE_BUFFER_SIZE samples. The work is done in
+///	the block handler on each block.
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+#include "Capture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of samples the capture buffer holds. 1 KB of the 8 KB of
+/// RAM, 28 vectors of all 18 channels. Paid for by the smaller receive fifo
+/// and timer wheel
+///////////////////////////////////////////////////////////////////////////////
+#define CAPTURE_BUFFER_SIZE 512
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the capture buffer
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t Buffer[CAPTURE_BUFFER_SIZE];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of samples of the buffer in use. Whole vectors
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t RingSize;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief where the next vector goes in the buffer
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t WriteOffset;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief where the oldest vector of the frozen capture is in the buffer
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t StartOffset;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of vectors taken since armed
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t VectorCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of post trigger vectors still to take
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t RemainingVectors;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of samples in each vector
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t ChannelCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the position in the vector of the channel the trigger looks at
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t TriggerIndex;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the trigger type
+///////////////////////////////////////////////////////////////////////////////
+static CaptureTriggerType Trigger;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the trigger level, or the step for the slope trigger
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t TriggerLevel;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the trigger channel sample of the last vector
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t PreviousSample;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of vectors kept from before the trigger
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t PreVectors;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of vectors taken from the trigger on
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t PostVectors;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief timestamp of the block the trigger fired in
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t TriggerTimestampMs;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the same in micro-seconds
+///////////////////////////////////////////////////////////////////////////////
+static uint64_t TriggerTimestampUs;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the capture state. Moved on by the block handler once armed
+///////////////////////////////////////////////////////////////////////////////
+static volatile CaptureStateType State;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief check the trigger against the trigger channel sample
+///
+///	\param sample the trigger channel sample of the new vector
+///
+///	\return TRUE fire
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t IsTriggered(uint32_t sample)
+{
+	switch ( Trigger )
+	{
+		case CaptureTrigger_Rising:
+			return (PreviousSample < TriggerLevel && sample >= TriggerLevel) ? TRUE : FALSE;
+
+		case CaptureTrigger_Falling:
+			return (PreviousSample > TriggerLevel && sample <= TriggerLevel) ? TRUE : FALSE;
+
+		default:
+			if ( sample >= PreviousSample )
+			{
+				return ((sample - PreviousSample) >= TriggerLevel) ? TRUE : FALSE;
+			}
+
+			return ((PreviousSample - sample) >= TriggerLevel) ? TRUE : FALSE;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the ADC block handler. Adds the block to the capture
+///
+///	\param block the complete block
+///////////////////////////////////////////////////////////////////////////////
+static void ProcessBlock(const ADCBlockType *block)
+{
+	const uint16_t *Sample = block->Samples;
+	uint16_t *Destination;
+	uint32_t Vector;
+	uint32_t Channel;
+	uint32_t Value;
+
+	if ( CaptureState_Armed != State && CaptureState_Triggered != State )
+	{
+		return;
+	}
+
+	if ( block->NumberOfChannels != ChannelCount )
+	{
+		// the scan changed. The capture can't be completed
+		State = CaptureState_Idle;
+		return;
+	}
+
+	for ( Vector = 0; Vector < block->NumberOfVectors; Vector++ )
+	{
+		Destination = &Buffer[WriteOffset];
+
+		for ( Channel = 0; Channel < ChannelCount; Channel++ )
+		{
+			Destination[Channel] = *Sample++;
+		}
+
+		Value = Destination[TriggerIndex];
+
+		// only once the pre trigger history is full
+		if ( CaptureState_Armed == State && VectorCount >= PreVectors && VectorCount && TRUE == IsTriggered(Value) )
+		{
+			RemainingVectors = PostVectors;
+			TriggerTimestampMs = block->TimestampMs;
+			TriggerTimestampUs = block->TimestampUs;
+			State = CaptureState_Triggered;
+		}
+
+		PreviousSample = Value;
+		VectorCount++;
+
+		WriteOffset += ChannelCount;
+
+		if ( WriteOffset >= RingSize )
+		{
+			WriteOffset = 0;
+		}
+
+		if ( CaptureState_Triggered == State && !--RemainingVectors )
+		{
+			Value = (PreVectors + PostVectors) * ChannelCount;
+			StartOffset = (WriteOffset >= Value) ? (WriteOffset - Value) : (WriteOffset + RingSize - Value);
+
+			// publish the capture before the done state
+			MEMORY_BARRIER();
+			State = CaptureState_Done;
+			return;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief reverse part of the buffer in place
+///
+///	\param first the first sample
+///	\param last one past the last sample
+///////////////////////////////////////////////////////////////////////////////
+static void ReverseSamples(uint32_t first, uint32_t last)
+{
+	uint16_t Sample;
+
+	while ( first + 1 < last )
+	{
+		last--;
+		Sample = Buffer[first];
+		Buffer[first] = Buffer[last];
+		Buffer[last] = Sample;
+		first++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief set the capture up. Call once at start up
+///////////////////////////////////////////////////////////////////////////////
+void Capture_Init(void)
+{
+	State = CaptureState_Idle;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return the number of samples the capture buffer holds. The most
+/// vectors a capture can have is this over the scan channel count
+///////////////////////////////////////////////////////////////////////////////
+uint32_t Capture_GetBufferSize(void)
+{
+	return CAPTURE_BUFFER_SIZE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief start keeping the scan vectors and wait for the trigger. The scan
+/// must be running.
+///
+///	\param triggerIndex the position in the scan vector of the channel the
+///	trigger looks at
+///	\param trigger the trigger type
+///	\param level the trigger level, or the step for the slope trigger
+///	\param preVectors number of vectors to keep from before the trigger
+///	\param postVectors number of vectors to take from the trigger on.
+///	Includes the vector that fired the trigger
+///
+///	\return TRUE armed. FALSE no scan, bad parameters or no block handler
+///	slot free
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t Capture_Arm(uint32_t triggerIndex, CaptureTriggerType trigger, uint32_t level, uint32_t preVectors, uint32_t postVectors)
+{
+	uint32_t Channels = ADC_Scan_GetChannelCount();
+	uint32_t MaxVectors;
+
+	if ( !Channels || triggerIndex >= Channels || (uint32_t)trigger > CaptureTrigger_Slope || !postVectors )
+	{
+		return FALSE;
+	}
+
+	MaxVectors = CAPTURE_BUFFER_SIZE / Channels;
+
+	if ( preVectors > MaxVectors || postVectors > (MaxVectors - preVectors) )
+	{
+		return FALSE;
+	}
+
+	ADC_Scan_RemoveBlockHandler(ProcessBlock);
+
+	ChannelCount = Channels;
+	RingSize = MaxVectors * Channels;
+	TriggerIndex = triggerIndex;
+	Trigger = trigger;
+	TriggerLevel = level;
+	PreVectors = preVectors;
+	PostVectors = postVectors;
+	WriteOffset = 0;
+	VectorCount = 0;
+	State = CaptureState_Armed;
+
+	if ( TRUE != ADC_Scan_AddBlockHandler(ProcessBlock) )
+	{
+		State = CaptureState_Idle;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief stop capturing. A frozen capture is dropped
+///////////////////////////////////////////////////////////////////////////////
+void Capture_Stop(void)
+{
+	ADC_Scan_RemoveBlockHandler(ProcessBlock);
+
+	State = CaptureState_Idle;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return the capture state
+///////////////////////////////////////////////////////////////////////////////
+CaptureStateType Capture_GetState(void)
+{
+	return State;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return the frozen capture. The first call turns the circular
+/// buffer round in place so the capture is in one piece and can be sent
+/// without copying it. It stays valid until the capture is armed again.
+///
+///	\param destination where to put the capture
+///
+///	\return TRUE success. FALSE no frozen capture
+///	ERROR_INVALID_POINTER = Invalid destination pointer
+///////////////////////////////////////////////////////////////////////////////
+int_fast8_t Capture_Get(CaptureType *destination)
+{
+	if ( !destination )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	if ( CaptureState_Done != State )
+	{
+		return FALSE;
+	}
+
+	// make sure we don't read the capture before the done state
+	MEMORY_BARRIER();
+
+	if ( StartOffset )
+	{
+		// rotate left by three reversals
+		ReverseSamples(0, StartOffset);
+		ReverseSamples(StartOffset, RingSize);
+		ReverseSamples(0, RingSize);
+		StartOffset = 0;
+	}
+
+	destination->Samples = &Buffer[0];
+	destination->NumberOfVectors = PreVectors + PostVectors;
+	destination->NumberOfChannels = ChannelCount;
+	destination->TriggerVector = PreVectors;
+	destination->TimestampMs = TriggerTimestampMs;
+	destination->TimestampUs = TriggerTimestampUs;
+
+	return TRUE;
+}
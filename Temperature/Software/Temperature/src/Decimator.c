@@ -0,0 +1,232 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file Decimator.c
+///
+///	\brief Decimating filter for the ADC scan
+///
+///	Adds up 2^shift scan vectors per channel (a boxcar, or a one stage CIC)
+///	and outputs one vector per sum. Every 4 samples added gain a bit of
+///	resolution, so the sum is shifted down by only half of shift and the
+///	output keeps the extra shift / 2 bits.
+///
+///	The sums are done in the block handler on each block. The main loop takes
+///	the outputs with Decimator_Read.
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+#include "Decimator.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of outputs held for the main loop. Must be a power of two
+///////////////////////////////////////////////////////////////////////////////
+#define DECIMATOR_OUTPUT_DEPTH 4
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the running sum of each channel
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t Sum[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of vectors in the sums
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t SumCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of channels in the sums
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t SumChannelCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief log2 of the decimation ratio
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t DecimationShift;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the outputs waiting for the main loop. The block handler only moves
+/// OutputWritePosition and the main loop only OutputReadPosition
+///////////////////////////////////////////////////////////////////////////////
+static DecimatorOutputType Output[DECIMATOR_OUTPUT_DEPTH];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running output write position
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t OutputWritePosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running output read position
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t OutputReadPosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of outputs dropped because the main loop was behind
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t OutputOverflowCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief clear the sums
+///
+///	\param numberOfChannels the channels in the next vectors
+///////////////////////////////////////////////////////////////////////////////
+static void ResetSums(uint32_t numberOfChannels)
+{
+	uint32_t Channel;
+
+	for ( Channel = 0; Channel < ADC_NUMBER_OF_CHANNELS; Channel++ )
+	{
+		Sum[Channel] = 0;
+	}
+
+	SumCount = 0;
+	SumChannelCount = numberOfChannels;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief hand the sums to the main loop and start again
+///
+///	\param timestampMs the block timestamp
+///////////////////////////////////////////////////////////////////////////////
+static void PublishSums(uint32_t timestampMs)
+{
+	DecimatorOutputType *Destination;
+	uint32_t WritePosition = OutputWritePosition;
+	uint32_t OutputShift = DecimationShift - (DecimationShift / 2);
+	uint32_t Channel;
+
+	if ( (WritePosition - OutputReadPosition) >= DECIMATOR_OUTPUT_DEPTH )
+	{
+		OutputOverflowCount++;
+	}
+	else
+	{
+		Destination = &Output[WritePosition & (DECIMATOR_OUTPUT_DEPTH - 1)];
+
+		for ( Channel = 0; Channel < SumChannelCount; Channel++ )
+		{
+			Destination->Values[Channel] = Sum[Channel] >> OutputShift;
+		}
+
+		Destination->NumberOfValues = SumChannelCount;
+		Destination->TimestampMs = timestampMs;
+
+		// publish the output before moving the write position
+		MEMORY_BARRIER();
+
+		OutputWritePosition = WritePosition + 1;
+	}
+
+	ResetSums(SumChannelCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the ADC block handler. Adds the block into the sums
+///
+///	\param block the complete block
+///////////////////////////////////////////////////////////////////////////////
+static void ProcessBlock(const ADCBlockType *block)
+{
+	const uint16_t *Sample = block->Samples;
+	uint32_t Ratio = (uint32_t)1 << DecimationShift;
+	uint32_t Vector;
+	uint32_t Channel;
+
+	if ( block->NumberOfChannels != SumChannelCount )
+	{
+		// the scan changed. The sums are for other channels
+		ResetSums(block->NumberOfChannels);
+	}
+
+	for ( Vector = 0; Vector < block->NumberOfVectors; Vector++ )
+	{
+		for ( Channel = 0; Channel < SumChannelCount; Channel++ )
+		{
+			Sum[Channel] += *Sample++;
+		}
+
+		if ( ++SumCount >= Ratio )
+		{
+			PublishSums(block->TimestampMs);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief start decimating the ADC scan
+///
+///	\param shift log2 of the decimation ratio. 0 to DECIMATOR_MAX_SHIFT
+///
+///	\return TRUE success. FALSE shift too large or no block handler slot free
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t Decimator_Start(uint32_t shift)
+{
+	if ( shift > DECIMATOR_MAX_SHIFT )
+	{
+		return FALSE;
+	}
+
+	ADC_Scan_RemoveBlockHandler(ProcessBlock);
+
+	DecimationShift = shift;
+	ResetSums(0);
+	OutputReadPosition = OutputWritePosition;
+
+	return (TRUE == ADC_Scan_AddBlockHandler(ProcessBlock)) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief stop decimating
+///////////////////////////////////////////////////////////////////////////////
+void Decimator_Stop(void)
+{
+	ADC_Scan_RemoveBlockHandler(ProcessBlock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief take the oldest decimated vector
+///
+///	\param destination where to copy the vector
+///
+///	\return TRUE a vector was copied. FALSE none ready
+///	ERROR_INVALID_POINTER = Invalid destination pointer
+///////////////////////////////////////////////////////////////////////////////
+int_fast8_t Decimator_Read(DecimatorOutputType *destination)
+{
+	uint32_t ReadPosition = OutputReadPosition;
+
+	if ( !destination )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	if ( OutputWritePosition == ReadPosition )
+	{
+		return FALSE;
+	}
+
+	// make sure we don't read the output before the writer's position
+	MEMORY_BARRIER();
+
+	*destination = Output[ReadPosition & (DECIMATOR_OUTPUT_DEPTH - 1)];
+
+	// release the slot only after the output has been copied
+	MEMORY_BARRIER();
+
+	OutputReadPosition = ReadPosition + 1;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return TRUE if a decimated vector is waiting for Decimator_Read
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t Decimator_IsOutputPending(void)
+{
+	return (OutputWritePosition != OutputReadPosition) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return the number of outputs dropped because the main loop was
+/// behind
+///////////////////////////////////////////////////////////////////////////////
+uint32_t Decimator_GetOverflowCount(void)
+{
+	return OutputOverflowCount;
+}
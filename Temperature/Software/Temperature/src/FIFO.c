@@ -3,156 +3,360 @@
 ///
 ///	\brief This is our FIFO library
 ///
+///	The fifo is a single producer / single consumer ring. The writer owns
+///	WritePosition and the reader owns ReadPosition, so one side can run in an
+///	interrupt while the other runs in the main loop without a critical section.
+///
 ///	\author Ronald Sousa @Opticalworm
 ///////////////////////////////////////////////////////////////////////////////
-#include "common.h"
+#include <string.h>
+#include "FIFO.h"
 
 ////////////////////////////////////////////////////////
-///	\brief defines the fifo buffer max size.
-////////////////////////////////////////////////////////
-#define FIFO_BUFFER_MAX_SIZE 2560
-
-////////////////////////////////////////////////////////
-///	\brief Is our fifo buffer.
-///
-///	\note The fifo data type is unsigned 8bit
-////////////////////////////////////////////////////////
-static uint8_t Buffer[FIFO_BUFFER_MAX_SIZE];
-
-////////////////////////////////////////////////////////
-///	\brief keep track of the number of data in buffer
-///
-///	\sa Buffer[]
-////////////////////////////////////////////////////////
-static uint32_t BufferCurrentSize = 0;
-
-////////////////////////////////////////////////////////
-///	\brief keep track of the write buffer position
+///	\brief return the number of bytes in buffer
 ///
-///	\sa Buffer[] BufferCurrentSize FIFO_BUFFER_MAX_SIZE
+///	\param fifo the fifo to check
 ////////////////////////////////////////////////////////
-static uint32_t WritePosition = 0;
+uint32_t FIFO_CounnterBufferCount(const FIFO_Type *fifo)
+{
+	// the positions are free running so the difference is always
+	// correct, even after they overflow.
+	return fifo->WritePosition - fifo->ReadPosition;
+}
 
 ////////////////////////////////////////////////////////
-///	\brief keep track of the read buffer position
+///	\brief return the number of bytes that can still be written
 ///
-///	\sa Buffer[] BufferCurrentSize FIFO_BUFFER_MAX_SIZE
+///	\param fifo the fifo to check
 ////////////////////////////////////////////////////////
-static uint32_t ReadPosition = 0;
-
-
-////////////////////////////////////////////////////////
-///	\brief return the number of bytes in buffer
-////////////////////////////////////////////////////////
-uint32_t FIFO_CounnterBufferCount(void)
+uint32_t FIFO_FreeSpace(const FIFO_Type *fifo)
 {
-	/// \todo Implement interrupt save code. ie enable and disable interrupt
-
-	return BufferCurrentSize;
+	return (fifo->Mask + 1) - FIFO_CounnterBufferCount(fifo);
 }
+
 ////////////////////////////////////////////////////////
 ///	\brief This will init the fifo variables and
 ///	clear the buffer
 ///
+///	\param fifo the fifo to initialise
+///	\param buffer the storage used by the fifo
+///	\param size the buffer size. Must be a power of two
+///
+///	\return TRUE = success
+///			FALSE = size is not a power of two
+///			ERROR_INVALID_POINTER = Invalid fifo or buffer pointer
+///
+///	\note must not be called while the fifo is in use by an interrupt
 ////////////////////////////////////////////////////////
-void FIFO_Initialiser(void)
+int_fast8_t FIFO_Initialiser(FIFO_Type *fifo, uint8_t *buffer, uint32_t size)
 {
 	uint32_t BufferIndex;
 
-	WritePosition = 0;
-	ReadPosition = 0;
-	BufferCurrentSize = 0;
+	if ( !fifo || !buffer )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	if ( !size || (size & (size - 1)) )
+	{
+		return FALSE;
+	}
+
+	fifo->Buffer = buffer;
+	fifo->Mask = size - 1;
+	fifo->WritePosition = 0;
+	fifo->ReadPosition = 0;
 
-	for( BufferIndex = 0 ; BufferIndex < FIFO_BUFFER_MAX_SIZE; BufferIndex++ )
+	for( BufferIndex = 0 ; BufferIndex < size; BufferIndex++ )
 	{
-		Buffer[BufferIndex] = 0;
+		buffer[BufferIndex] = 0;
 	}
+
+	return TRUE;
 }
 
 ////////////////////////////////////////////////////////
 /// \brief Read one bute from the buffer. Return false
 ///	if we didn't.
 ///
+///	\param fifo the fifo to read from
 ///	\param outputDataPointer pointer to return the read value.
 ///
 ///	\return TRUE = successfully read a byte rom buffer
 ///			FALSE = no data to read
 ///			ERROR_INVALID_POINTER = Invalid outputDataPointer pointer
 ///
+///	\note only the consumer may call this function
 ////////////////////////////////////////////////////////
-uint_fast8_t FIFO_Read(uint8_t *outputDataPointer)
+int_fast8_t FIFO_Read(FIFO_Type *fifo, uint8_t *outputDataPointer)
 {
-	uint_fast8_t Result = FALSE;
+	uint32_t ReadPosition;
 
 	// check pointer is valid and not set to zero
-	if ( outputDataPointer )
+	if ( !outputDataPointer )
 	{
-		if( BufferCurrentSize > 0)
-		{
-			// we have data to read
+		return ERROR_INVALID_POINTER;
+	}
 
-			// Pass the data back
-			*outputDataPointer = Buffer[ReadPosition];
+	ReadPosition = fifo->ReadPosition;
 
-			ReadPosition++;
+	if( fifo->WritePosition == ReadPosition )
+	{
+		// no data to read
+		return FALSE;
+	}
 
-			BufferCurrentSize--;
+	// make sure we don't read the data before the producer's position
+	MEMORY_BARRIER();
 
-			if( ReadPosition == FIFO_BUFFER_MAX_SIZE )
-			{
-				ReadPosition = 0;
-			}
+	// Pass the data back
+	*outputDataPointer = fifo->Buffer[ReadPosition & fifo->Mask];
 
-			Result = TRUE;
-		}
-	}
-	else
-	{
-		// pointer error
-		Result = ERROR_INVALID_POINTER;
-	}
+	// release the slot only after the data has been copied
+	MEMORY_BARRIER();
 
+	fifo->ReadPosition = ReadPosition + 1;
 
-	return Result;
+	return TRUE;
 }
 
 ////////////////////////////////////////////////////////
 ///	\brief Write inputData into our buffer.
 ///
+///	\param fifo the fifo to write to
 ///	\param inputData copy of the data we want to store
 ///
 ///	\return TRUE = successfully writing data to our buffer
 ///			FALSE = No space in buffer
+///
+///	\note only the producer may call this function
 ////////////////////////////////////////////////////////
-uint_fast8_t FIFO_Write(uint8_t inputData)
+uint_fast8_t FIFO_Write(FIFO_Type *fifo, uint8_t inputData)
 {
-	uint_fast8_t Result = FALSE;
+	uint32_t WritePosition = fifo->WritePosition;
+
+	if( (WritePosition - fifo->ReadPosition) > fifo->Mask )
+	{
+		// No space
+		return FALSE;
+	}
+
+	fifo->Buffer[WritePosition & fifo->Mask] = inputData;
+
+	// publish the data before moving the write position
+	MEMORY_BARRIER();
 
+	fifo->WritePosition = WritePosition + 1;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////
+///	\brief return the largest contiguous region that can be
+///	written without wrapping. Fill it in place and then call
+///	FIFO_CommitWrite.
+///
+///	\param fifo the fifo to write to
+///	\param destination pointer to return the start of the region
+///
+///	\return the region size in bytes. 0 = fifo is full
+///
+///	\note only the producer may call this function
+////////////////////////////////////////////////////////
+uint32_t FIFO_PeekWrite(FIFO_Type *fifo, uint8_t **destination)
+{
+	uint32_t WriteIndex = fifo->WritePosition & fifo->Mask;
+	uint32_t Length = FIFO_FreeSpace(fifo);
 
-	if( BufferCurrentSize < FIFO_BUFFER_MAX_SIZE )
+	// stop at the end of the buffer
+	if ( Length > ((fifo->Mask + 1) - WriteIndex) )
 	{
-		// We have space
+		Length = (fifo->Mask + 1) - WriteIndex;
+	}
 
-		Buffer[WritePosition] = inputData;
+	*destination = &fifo->Buffer[WriteIndex];
+
+	return Length;
+}
 
-		BufferCurrentSize++;
+////////////////////////////////////////////////////////
+///	\brief publish length bytes written in place after
+///	FIFO_PeekWrite
+///
+///	\param fifo the fifo to commit to
+///	\param length number of bytes written
+///
+///	\return TRUE = success
+///			FALSE = length is larger than the free space. nothing is committed
+///
+///	\note only the producer may call this function
+////////////////////////////////////////////////////////
+uint_fast8_t FIFO_CommitWrite(FIFO_Type *fifo, uint32_t length)
+{
+	if ( length > FIFO_FreeSpace(fifo) )
+	{
+		return FALSE;
+	}
 
-		WritePosition++;
+	// publish the data before moving the write position
+	MEMORY_BARRIER();
 
-		// check to see if we need to reset the write position index counter.
-		// this will ensure that the buffer is circulating
-		if ( FIFO_BUFFER_MAX_SIZE == WritePosition )
+	fifo->WritePosition += length;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////
+///	\brief return the largest contiguous region that can be
+///	read without wrapping. Consume it in place and then call
+///	FIFO_CommitRead.
+///
+///	\param fifo the fifo to read from
+///	\param source pointer to return the start of the region
+///
+///	\return the region size in bytes. 0 = no data to read
+///
+///	\note only the consumer may call this function
+////////////////////////////////////////////////////////
+uint32_t FIFO_PeekRead(FIFO_Type *fifo, uint8_t **source)
+{
+	uint32_t ReadIndex = fifo->ReadPosition & fifo->Mask;
+	uint32_t Length = FIFO_CounnterBufferCount(fifo);
+
+	// stop at the end of the buffer
+	if ( Length > ((fifo->Mask + 1) - ReadIndex) )
+	{
+		Length = (fifo->Mask + 1) - ReadIndex;
+	}
+
+	// make sure we don't read the data before the producer's position
+	MEMORY_BARRIER();
+
+	*source = &fifo->Buffer[ReadIndex];
+
+	return Length;
+}
+
+////////////////////////////////////////////////////////
+///	\brief release length bytes consumed in place after
+///	FIFO_PeekRead
+///
+///	\param fifo the fifo to commit to
+///	\param length number of bytes consumed
+///
+///	\return TRUE = success
+///			FALSE = length is larger than the data in the fifo. nothing is released
+///
+///	\note only the consumer may call this function
+////////////////////////////////////////////////////////
+uint_fast8_t FIFO_CommitRead(FIFO_Type *fifo, uint32_t length)
+{
+	if ( length > FIFO_CounnterBufferCount(fifo) )
+	{
+		return FALSE;
+	}
+
+	// release the slots only after the data has been used
+	MEMORY_BARRIER();
+
+	fifo->ReadPosition += length;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////
+///	\brief Write as much of the source array as fits into
+///	the buffer.
+///
+///	\param fifo the fifo to write to
+///	\param source the data to copy
+///	\param length number of bytes to copy
+///
+///	\return number of bytes written
+///
+///	\note only the producer may call this function
+////////////////////////////////////////////////////////
+uint32_t FIFO_WriteBlock(FIFO_Type *fifo, const uint8_t *source, uint32_t length)
+{
+	uint8_t *Destination;
+	uint32_t RegionLength;
+	uint32_t Written = 0;
+
+	if ( !source )
+	{
+		return 0;
+	}
+
+	// at most two passes. one up to the end of the buffer and one from the start
+	while ( length )
+	{
+		RegionLength = FIFO_PeekWrite(fifo, &Destination);
+
+		if ( !RegionLength )
+		{
+			break;
+		}
+
+		if ( RegionLength > length )
 		{
-			WritePosition = 0;
+			RegionLength = length;
 		}
 
-		Result = TRUE;
+		memcpy(Destination, source, RegionLength);
+		FIFO_CommitWrite(fifo, RegionLength);
+
+		source += RegionLength;
+		length -= RegionLength;
+		Written += RegionLength;
 	}
 
-	return Result;
+	return Written;
 }
 
+////////////////////////////////////////////////////////
+///	\brief Read up to length bytes from the buffer.
+///
+///	\param fifo the fifo to read from
+///	\param destination where to copy the data to
+///	\param length max number of bytes to read
+///
+///	\return number of bytes read
+///
+///	\note only the consumer may call this function
+////////////////////////////////////////////////////////
+uint32_t FIFO_ReadBlock(FIFO_Type *fifo, uint8_t *destination, uint32_t length)
+{
+	uint8_t *Source;
+	uint32_t RegionLength;
+	uint32_t Read = 0;
+
+	if ( !destination )
+	{
+		return 0;
+	}
+
+	// at most two passes. one up to the end of the buffer and one from the start
+	while ( length )
+	{
+		RegionLength = FIFO_PeekRead(fifo, &Source);
+
+		if ( !RegionLength )
+		{
+			break;
+		}
 
+		if ( RegionLength > length )
+		{
+			RegionLength = length;
+		}
 
+		memcpy(destination, Source, RegionLength);
+		FIFO_CommitRead(fifo, RegionLength);
 
+		destination += RegionLength;
+		length -= RegionLength;
+		Read += RegionLength;
+	}
 
+	return Read;
+}
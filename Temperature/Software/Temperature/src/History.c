@@ -0,0 +1,668 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file History.c
+///
+///	\brief Temperature history with windowed statistics
+///
+///	The temperature channel of the scan is averaged over 2^shift vectors in
+///	the block handler and handed to the main loop, which converts it to
+///	centi-degrees and adds it to the history.
+///
+///	The history is delta compressed. A sample within 127 centi-degrees of
+///	the one before takes one byte, any other sample an escape byte and the
+///	value. The oldest samples are dropped to make room.
+///
+///	The statistics window keeps a running sum and sum of squares, and two
+///	monotonic deques for the minimum and maximum, all updated as samples
+///	come and go. So a query costs the same whatever the window. Only a
+///	change of window size replays the history once.
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+#include "History.h"
+#include "MCU/tick.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the history size in bytes. Must be a power of two
+///////////////////////////////////////////////////////////////////////////////
+#define HISTORY_BUFFER_SIZE 256
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief marks a sample stored as its value instead of a delta
+///////////////////////////////////////////////////////////////////////////////
+#define HISTORY_ESCAPE 0x80
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the size of an escaped sample. The escape and a 16 bit value
+///////////////////////////////////////////////////////////////////////////////
+#define HISTORY_ESCAPE_SIZE 3
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of averages held for the main loop. Must be a power of two
+///////////////////////////////////////////////////////////////////////////////
+#define HISTORY_INPUT_DEPTH 8
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief HISTORY_MAX_WINDOW is a power of two so the deques can be masked
+///////////////////////////////////////////////////////////////////////////////
+#define HISTORY_DEQUE_MASK (HISTORY_MAX_WINDOW - 1)
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief define an average from the interrupt
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	uint16_t Temperature;	///< the temperature sensor average
+	uint16_t Vrefint;		///< the VREFINT average. 0 = not in the scan
+} HistoryInputType;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the temperature sensor running sum
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t TemperatureSum;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the VREFINT running sum
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t VrefintSum;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of vectors in the sums
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t SumCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the scan channels the sums are for
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t SumChannelMask;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief log2 of the vectors in each average
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t AverageShift;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the averages waiting for the main loop. The block handler only
+/// moves InputWritePosition and the main loop only InputReadPosition
+///////////////////////////////////////////////////////////////////////////////
+static HistoryInputType Input[HISTORY_INPUT_DEPTH];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running input write position
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t InputWritePosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running input read position
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t InputReadPosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of averages dropped because the main loop was behind
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t InputOverflowCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the compressed history
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t Buffer[HISTORY_BUFFER_SIZE];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running position of the next sample
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t WritePosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running position of the oldest sample
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t TailPosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the value of the oldest sample
+///////////////////////////////////////////////////////////////////////////////
+static int32_t TailValue;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the value of the newest sample
+///////////////////////////////////////////////////////////////////////////////
+static int32_t LatestValue;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of samples in the history
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t NumberOfSamples;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief counts the samples ever added. The newest is Sequence - 1
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t Sequence;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the window size asked for
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t WindowSize = HISTORY_MAX_WINDOW;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of samples in the window
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t WindowCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running position of the oldest sample in the window
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t WindowTailPosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the value of the oldest sample in the window
+///////////////////////////////////////////////////////////////////////////////
+static int32_t WindowTailValue;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief sum of the window samples
+///////////////////////////////////////////////////////////////////////////////
+static int32_t WindowSum;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief sum of the squares of the window samples
+///////////////////////////////////////////////////////////////////////////////
+static int64_t WindowSumSquares;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the minimum deque. Rising values from the head, so the head is
+/// the minimum of the window
+///////////////////////////////////////////////////////////////////////////////
+static int16_t MinimumValues[HISTORY_MAX_WINDOW];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the low byte of the sequence of each minimum deque entry
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t MinimumSequences[HISTORY_MAX_WINDOW];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running minimum deque head and tail
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t MinimumHead, MinimumTail;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the maximum deque. Falling values from the head, so the head is
+/// the maximum of the window
+///////////////////////////////////////////////////////////////////////////////
+static int16_t MaximumValues[HISTORY_MAX_WINDOW];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the low byte of the sequence of each maximum deque entry
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t MaximumSequences[HISTORY_MAX_WINDOW];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running maximum deque head and tail
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t MaximumHead, MaximumTail;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief clear the sums
+///
+///	\param channelMask the channels in the next vectors
+///////////////////////////////////////////////////////////////////////////////
+static void ResetSums(uint32_t channelMask)
+{
+	TemperatureSum = 0;
+	VrefintSum = 0;
+	SumCount = 0;
+	SumChannelMask = channelMask;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief hand the averages to the main loop and start again
+///////////////////////////////////////////////////////////////////////////////
+static void PublishSums(void)
+{
+	HistoryInputType *Destination;
+	uint32_t WritePosition = InputWritePosition;
+	uint32_t Half = ((uint32_t)1 << AverageShift) >> 1;
+
+	if ( (WritePosition - InputReadPosition) >= HISTORY_INPUT_DEPTH )
+	{
+		InputOverflowCount++;
+	}
+	else
+	{
+		Destination = &Input[WritePosition & (HISTORY_INPUT_DEPTH - 1)];
+		Destination->Temperature = (uint16_t)((TemperatureSum + Half) >> AverageShift);
+		Destination->Vrefint = (uint16_t)((VrefintSum + Half) >> AverageShift);
+
+		// publish the average before moving the write position
+		MEMORY_BARRIER();
+
+		InputWritePosition = WritePosition + 1;
+	}
+
+	ResetSums(SumChannelMask);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the ADC block handler. Adds the temperature channel into the sums
+///
+///	\param block the complete block
+///////////////////////////////////////////////////////////////////////////////
+static void ProcessBlock(const ADCBlockType *block)
+{
+	const uint16_t *Vector = block->Samples;
+	uint32_t Ratio = (uint32_t)1 << AverageShift;
+	uint32_t TemperatureIndex = 0;
+	uint32_t Mask;
+	uint32_t Index;
+
+	if ( !(block->ChannelMask & ((uint32_t)1 << ADC_TEMPERATURE_CHANNEL)) )
+	{
+		return;
+	}
+
+	if ( block->ChannelMask != SumChannelMask )
+	{
+		// the scan changed. The sums are for other channels
+		ResetSums(block->ChannelMask);
+	}
+
+	// the vector is in channel number order
+	for ( Mask = block->ChannelMask & (((uint32_t)1 << ADC_TEMPERATURE_CHANNEL) - 1); Mask; Mask &= Mask - 1 )
+	{
+		TemperatureIndex++;
+	}
+
+	for ( Index = 0; Index < block->NumberOfVectors; Index++, Vector += block->NumberOfChannels )
+	{
+		TemperatureSum += Vector[TemperatureIndex];
+
+		if ( block->ChannelMask & ((uint32_t)1 << ADC_VREFINT_CHANNEL) )
+		{
+			// VREFINT is the channel after the sensor
+			VrefintSum += Vector[TemperatureIndex + 1];
+		}
+
+		if ( ++SumCount >= Ratio )
+		{
+			PublishSums();
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief move a position to the next sample and decode it
+///
+///	\param position the position to move. Must not be the newest sample
+///	\param value the value at the position. Updated to the next value
+///////////////////////////////////////////////////////////////////////////////
+static void NextSample(uint32_t *position, int32_t *value)
+{
+	uint32_t Position = *position;
+
+	Position += (HISTORY_ESCAPE == Buffer[Position & (HISTORY_BUFFER_SIZE - 1)]) ? HISTORY_ESCAPE_SIZE : 1;
+
+	if ( HISTORY_ESCAPE == Buffer[Position & (HISTORY_BUFFER_SIZE - 1)] )
+	{
+		*value = (int16_t)(Buffer[(Position + 1) & (HISTORY_BUFFER_SIZE - 1)] |
+				((uint16_t)Buffer[(Position + 2) & (HISTORY_BUFFER_SIZE - 1)] << 8));
+	}
+	else
+	{
+		*value += (int8_t)Buffer[Position & (HISTORY_BUFFER_SIZE - 1)];
+	}
+
+	*position = Position;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief add a sample to the window
+///
+///	\param value the sample
+///	\param position where the sample is in the history
+///	\param sequence the sample sequence
+///////////////////////////////////////////////////////////////////////////////
+static void PushWindow(int32_t value, uint32_t position, uint32_t sequence)
+{
+	// drop the entries the new sample outlives and beats
+	while ( MaximumTail != MaximumHead && MaximumValues[(MaximumTail - 1) & HISTORY_DEQUE_MASK] <= value )
+	{
+		MaximumTail--;
+	}
+
+	MaximumValues[MaximumTail & HISTORY_DEQUE_MASK] = (int16_t)value;
+	MaximumSequences[MaximumTail & HISTORY_DEQUE_MASK] = (uint8_t)sequence;
+	MaximumTail++;
+
+	while ( MinimumTail != MinimumHead && MinimumValues[(MinimumTail - 1) & HISTORY_DEQUE_MASK] >= value )
+	{
+		MinimumTail--;
+	}
+
+	MinimumValues[MinimumTail & HISTORY_DEQUE_MASK] = (int16_t)value;
+	MinimumSequences[MinimumTail & HISTORY_DEQUE_MASK] = (uint8_t)sequence;
+	MinimumTail++;
+
+	if ( !WindowCount )
+	{
+		WindowTailPosition = position;
+		WindowTailValue = value;
+	}
+
+	WindowSum += value;
+	WindowSumSquares += (int64_t)value * value;
+	WindowCount++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief drop the oldest sample from the window
+///////////////////////////////////////////////////////////////////////////////
+static void PopWindow(void)
+{
+	// the window is up to the newest sample
+	uint8_t OldestSequence = (uint8_t)(Sequence - WindowCount);
+
+	if ( MaximumHead != MaximumTail && OldestSequence == MaximumSequences[MaximumHead & HISTORY_DEQUE_MASK] )
+	{
+		MaximumHead++;
+	}
+
+	if ( MinimumHead != MinimumTail && OldestSequence == MinimumSequences[MinimumHead & HISTORY_DEQUE_MASK] )
+	{
+		MinimumHead++;
+	}
+
+	WindowSum -= WindowTailValue;
+	WindowSumSquares -= (int64_t)WindowTailValue * WindowTailValue;
+	WindowCount--;
+
+	if ( WindowCount )
+	{
+		NextSample(&WindowTailPosition, &WindowTailValue);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief empty the window
+///////////////////////////////////////////////////////////////////////////////
+static void ResetWindow(void)
+{
+	WindowCount = 0;
+	WindowSum = 0;
+	WindowSumSquares = 0;
+	MinimumHead = MinimumTail = 0;
+	MaximumHead = MaximumTail = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief drop the oldest sample from the history
+///////////////////////////////////////////////////////////////////////////////
+static void DropOldest(void)
+{
+	if ( WindowCount == NumberOfSamples )
+	{
+		// the window starts at the oldest sample
+		PopWindow();
+	}
+
+	NumberOfSamples--;
+
+	if ( NumberOfSamples )
+	{
+		NextSample(&TailPosition, &TailValue);
+	}
+	else
+	{
+		TailPosition = WritePosition;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief add a sample to the history and the window
+///
+///	\param value the sample in centi-degrees
+///////////////////////////////////////////////////////////////////////////////
+static void AddSample(int32_t value)
+{
+	uint32_t Position;
+	int32_t Delta;
+
+	if ( value > INT16_MAX )
+	{
+		value = INT16_MAX;
+	}
+	else if ( value < INT16_MIN )
+	{
+		value = INT16_MIN;
+	}
+
+	while ( NumberOfSamples && (HISTORY_BUFFER_SIZE - (WritePosition - TailPosition)) < HISTORY_ESCAPE_SIZE )
+	{
+		DropOldest();
+	}
+
+	if ( WindowCount >= WindowSize )
+	{
+		PopWindow();
+	}
+
+	Position = WritePosition;
+	Delta = value - LatestValue;
+
+	// -128 is the escape
+	if ( NumberOfSamples && Delta > INT8_MIN && Delta <= INT8_MAX )
+	{
+		Buffer[WritePosition++ & (HISTORY_BUFFER_SIZE - 1)] = (uint8_t)Delta;
+	}
+	else
+	{
+		Buffer[WritePosition++ & (HISTORY_BUFFER_SIZE - 1)] = HISTORY_ESCAPE;
+		Buffer[WritePosition++ & (HISTORY_BUFFER_SIZE - 1)] = (uint8_t)value;
+		Buffer[WritePosition++ & (HISTORY_BUFFER_SIZE - 1)] = (uint8_t)((uint32_t)value >> 8);
+	}
+
+	if ( !NumberOfSamples )
+	{
+		TailPosition = Position;
+		TailValue = value;
+	}
+
+	NumberOfSamples++;
+	LatestValue = value;
+
+	PushWindow(value, Position, Sequence++);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief change the window size and refill the window from the history
+///
+///	\param window the window size
+///////////////////////////////////////////////////////////////////////////////
+static void SetWindow(uint32_t window)
+{
+	uint32_t Position = TailPosition;
+	int32_t Value = TailValue;
+	uint32_t Skip = (NumberOfSamples > window) ? (NumberOfSamples - window) : 0;
+	uint32_t Index;
+
+	WindowSize = window;
+	ResetWindow();
+
+	for ( Index = 0; Index < NumberOfSamples; Index++ )
+	{
+		if ( Index >= Skip )
+		{
+			PushWindow(Value, Position, Sequence - NumberOfSamples + Index);
+		}
+
+		if ( (Index + 1) < NumberOfSamples )
+		{
+			NextSample(&Position, &Value);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return the integer square root
+///
+///	\param value the value
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t SquareRoot(uint64_t value)
+{
+	uint64_t Root = 0;
+	uint64_t Bit = (uint64_t)1 << 62;
+
+	while ( Bit > value )
+	{
+		Bit >>= 2;
+	}
+
+	while ( Bit )
+	{
+		if ( value >= (Root + Bit) )
+		{
+			value -= Root + Bit;
+			Root = (Root >> 1) + Bit;
+		}
+		else
+		{
+			Root >>= 1;
+		}
+
+		Bit >>= 2;
+	}
+
+	return (uint32_t)Root;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief clear the history and start taking the temperature from the scan.
+/// The scan must include the temperature sensor, and VREFINT to compensate
+/// for the supply.
+///
+///	\param shift log2 of the scan vectors averaged into one sample. 0 to
+///	HISTORY_MAX_SHIFT
+///
+///	\return TRUE success. FALSE shift too large or no block handler slot free
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t History_Start(uint32_t shift)
+{
+	if ( shift > HISTORY_MAX_SHIFT )
+	{
+		return FALSE;
+	}
+
+	ADC_Scan_RemoveBlockHandler(ProcessBlock);
+
+	AverageShift = shift;
+	ResetSums(0);
+	InputReadPosition = InputWritePosition;
+
+	WritePosition = 0;
+	TailPosition = 0;
+	NumberOfSamples = 0;
+	ResetWindow();
+
+	return (TRUE == ADC_Scan_AddBlockHandler(ProcessBlock)) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief stop taking samples. The history is kept
+///////////////////////////////////////////////////////////////////////////////
+void History_Stop(void)
+{
+	ADC_Scan_RemoveBlockHandler(ProcessBlock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief add the averages from the interrupt to the history. Call from the
+/// main loop
+///////////////////////////////////////////////////////////////////////////////
+void History_Process(void)
+{
+	HistoryInputType Average;
+	uint32_t ReadPosition = InputReadPosition;
+
+	while ( InputWritePosition != ReadPosition )
+	{
+		// make sure we don't read the average before the writer's position
+		MEMORY_BARRIER();
+
+		Average = Input[ReadPosition & (HISTORY_INPUT_DEPTH - 1)];
+
+		// release the slot only after the average has been copied
+		MEMORY_BARRIER();
+
+		InputReadPosition = ++ReadPosition;
+
+		if ( Average.Vrefint )
+		{
+			AddSample(ADC_ReturnCompensatedTemperature(Average.Temperature, ADC_ReturnSupplyFactor(Average.Vrefint)));
+		}
+		else
+		{
+			AddSample(ADC_ReturnCalibratedTemperature(Average.Temperature));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return how long the core can sleep before History_Process has work.
+/// The block handler wakes it when it adds an average.
+///
+///	\return 0 = averages to add. TICK_IDLE_FOREVER = none
+///////////////////////////////////////////////////////////////////////////////
+uint32_t History_GetIdleMs(void)
+{
+	return (InputWritePosition != InputReadPosition) ? 0 : TICK_IDLE_FOREVER;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return the number of samples in the history
+///////////////////////////////////////////////////////////////////////////////
+uint32_t History_GetNumberOfSamples(void)
+{
+	return NumberOfSamples;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return the statistics of the newest samples. The same window size
+/// as last time costs the same whatever the size. A new size replays the
+/// history once.
+///
+///	\param window number of samples. 1 to HISTORY_MAX_WINDOW
+///	\param destination where to put the statistics
+///
+///	\return TRUE success. FALSE bad window or no samples yet
+///	ERROR_INVALID_POINTER = Invalid destination pointer
+///////////////////////////////////////////////////////////////////////////////
+int_fast8_t History_GetStats(uint32_t window, HistoryStatsType *destination)
+{
+	int64_t Spread;
+	int32_t Half;
+
+	if ( !destination )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	if ( !window || window > HISTORY_MAX_WINDOW || !NumberOfSamples )
+	{
+		return FALSE;
+	}
+
+	if ( window != WindowSize )
+	{
+		SetWindow(window);
+	}
+
+	// round the mean to the nearest centi-degree
+	Half = (int32_t)(WindowCount / 2);
+	destination->Mean = (WindowSum + ((WindowSum < 0) ? -Half : Half)) / (int32_t)WindowCount;
+
+	// n^2 * variance = n * sum(x^2) - sum(x)^2
+	Spread = (WindowSumSquares * WindowCount) - ((int64_t)WindowSum * WindowSum);
+	destination->StandardDeviation = (int32_t)((SquareRoot((Spread > 0) ? (uint64_t)Spread : 0) + (WindowCount / 2)) / WindowCount);
+
+	destination->NumberOfSamples = WindowCount;
+	destination->Minimum = MinimumValues[MinimumHead & HISTORY_DEQUE_MASK];
+	destination->Maximum = MaximumValues[MaximumHead & HISTORY_DEQUE_MASK];
+	destination->Latest = LatestValue;
+
+	return TRUE;
+}
@@ -5,126 +5,1593 @@
 ///	Author: Ronald Sousa (Opticalworm)
 /////////////////////////////////////////////////////////////////////////
 #include "MCU/adc.h"
+#include "MCU/tick.h"
+#include "MCU/timer.h"
+#include "MCU/event.h"
+
+/* Temperature sensor calibration value address */
+#define TEMP110_CAL_ADDR ((uint16_t*) ((uint32_t) 0x1FFFF7C2))
+#define TEMP30_CAL_ADDR ((uint16_t*) ((uint32_t) 0x1FFFF7B8))
+#define VREFINT_CAL_ADDR ((uint16_t*) ((uint32_t) 0x1FFFF7BA))
+#define VDD_CALIB ((uint16_t) (330))
+#define VDD_APPLI ((uint16_t) (300))
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief fraction bits of the temperature coefficients. Leaves room for
+/// a 12 bit sample times the slope in an int32
+/////////////////////////////////////////////////////////////////////////
+#define TEMPERATURE_FRACTION_BITS 14
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief fraction bits of the supply factor
+/////////////////////////////////////////////////////////////////////////
+#define SUPPLY_FRACTION_BITS 14
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief fraction bits of the normalise factor. The sample times the
+/// factor is always just under 4096000000 so it fits an uint32
+/////////////////////////////////////////////////////////////////////////
+#define NORMALISE_FRACTION_BITS 12
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the normalised full scale. Parts per million
+/////////////////////////////////////////////////////////////////////////
+#define NORMALISE_FULL_SCALE 1000000
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief number of samples in the scan buffer. The DMA fills it in a
+/// circle, one half at a time
+/////////////////////////////////////////////////////////////////////////
+#define ADC_SCAN_BUFFER_SIZE 256
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the longest an ADC on or off step may take. Calibration and
+/// enabling take microseconds
+/////////////////////////////////////////////////////////////////////////
+#define ADC_TIMEOUT_MS 5
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the DMA channel wired to the ADC
+/////////////////////////////////////////////////////////////////////////
+#define ADC_DMA_CHANNEL DMA1_Channel1
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the default channel profile. 239.5 cycles, 12 bits, right
+/// aligned
+/////////////////////////////////////////////////////////////////////////
+#define ADC_DEFAULT_PROFILE { ADCSampleTime_239_5, ADCResolution_12Bit, ADCAlign_Right }
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the ADC clock. The dedicated 14MHz oscillator
+/////////////////////////////////////////////////////////////////////////
+#define ADC_CLOCK_HZ 14000000
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the timer that triggers the scans in the timer mode. Its TRGO is
+/// the ADC external trigger 3
+/////////////////////////////////////////////////////////////////////////
+#define ADC_TRIGGER_TIMER TIM3
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the ADC external trigger select for ADC_TRIGGER_TIMER
+/////////////////////////////////////////////////////////////////////////
+#define ADC_TRIGGER_SELECT (ADC_CFGR1_EXTSEL_1 | ADC_CFGR1_EXTSEL_0)
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the largest timer prescaler and reload count
+/////////////////////////////////////////////////////////////////////////
+#define TIMER_MAX_COUNT 65536
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief half ADC clocks taken by each sampling time
+/////////////////////////////////////////////////////////////////////////
+static const uint16_t SampleHalfCycles[] = { 3, 15, 27, 57, 83, 111, 143, 479 };
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief half ADC clocks taken to convert at each resolution
+/////////////////////////////////////////////////////////////////////////
+static const uint8_t ConversionHalfCycles[] = { 25, 21, 17, 13 };
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the channel profiles. Kept while the ADC is off
+/////////////////////////////////////////////////////////////////////////
+static ADCProfileType Profiles[ADC_NUMBER_OF_CHANNELS] = {
+	[0 ... ADC_NUMBER_OF_CHANNELS - 1] = ADC_DEFAULT_PROFILE
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief half ADC clocks taken by one vector of the scan
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ScanHalfCycles;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the DMA writes the scan vectors here
+/////////////////////////////////////////////////////////////////////////
+static uint16_t ScanBuffer[ADC_SCAN_BUFFER_SIZE];
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief number of samples the DMA writes before it wraps. Always a whole
+/// number of vectors in each half
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ScanLength;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief number of channels in a scan vector. 0 = the scan is stopped
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ScanChannelCount;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the channels in a scan vector
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ScanChannelMask;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief number of half buffers completed. Lets the reader find out if
+/// the DMA came round while it was copying
+/////////////////////////////////////////////////////////////////////////
+static volatile uint32_t ScanSequence;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief number of overruns. The scan is restarted after each one so
+/// the vectors stay aligned
+/////////////////////////////////////////////////////////////////////////
+static volatile uint32_t ScanOverrunCount;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief called each time a half buffer is complete. 0 = free slot
+/////////////////////////////////////////////////////////////////////////
+static ADCBlockHandlerType BlockHandler[ADC_MAX_BLOCK_HANDLERS];
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the newest complete block, waiting for the block handlers
+/////////////////////////////////////////////////////////////////////////
+static ADCBlockType PendingBlock;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief set by the DMA interrupt when PendingBlock has been written
+/////////////////////////////////////////////////////////////////////////
+static volatile uint8_t PendingBlockReady;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the watchdog window while the alarm is off
+/////////////////////////////////////////////////////////////////////////
+static uint32_t WatchdogLow;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the watchdog window while the alarm is off
+/////////////////////////////////////////////////////////////////////////
+static uint32_t WatchdogHigh;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief how far back inside the window the sample must come to clear
+/// the alarm
+/////////////////////////////////////////////////////////////////////////
+static uint32_t WatchdogHysteresis;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the alarm state. Only changed by the ADC interrupt
+/////////////////////////////////////////////////////////////////////////
+static volatile ADCAlarmStateType AlarmState;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief Tick_GetMs of the last alarm change
+/////////////////////////////////////////////////////////////////////////
+static volatile uint32_t AlarmTimestampMs;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief counts the alarm changes. Lets the reader spot a change and
+/// a change while it was reading
+/////////////////////////////////////////////////////////////////////////
+static volatile uint32_t AlarmChangeCount;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the timer mode scan rate in scans per second. 0 = not set
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ScanRate;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief centi-degrees per sample count at the calibration supply.
+/// Signed, TEMPERATURE_FRACTION_BITS fraction bits
+/////////////////////////////////////////////////////////////////////////
+static int32_t TemperatureSlope;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief centi-degrees at a sample of 0. Signed, TEMPERATURE_FRACTION_BITS
+/// fraction bits
+/////////////////////////////////////////////////////////////////////////
+static int32_t TemperatureOffset;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief parts per million per sample count for the current resolution.
+/// NORMALISE_FRACTION_BITS fraction bits
+/////////////////////////////////////////////////////////////////////////
+static uint32_t NormaliseFactor;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the VREFINT sample at the calibration supply
+/////////////////////////////////////////////////////////////////////////
+static uint32_t VrefintCalibration;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the supply factor used when VREFINT isn't sampled. Assumes
+/// VDD_APPLI
+/////////////////////////////////////////////////////////////////////////
+static uint32_t NominalSupplyFactor;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the ADC state
+/////////////////////////////////////////////////////////////////////////
+static volatile ADCStateType State;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief times out the ADC on and off steps
+/////////////////////////////////////////////////////////////////////////
+static TimerType StateTimer;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the RES bits ADCState_Resolving is changing to
+/////////////////////////////////////////////////////////////////////////
+static uint32_t PendingResolution;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief TRUE = set ADSTART once ADCState_Resolving is done
+/////////////////////////////////////////////////////////////////////////
+static volatile uint32_t StartWhenReady;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief Defines the ADC_Convert states
+/////////////////////////////////////////////////////////////////////////
+typedef enum {
+	ADCConversion_Idle = 0,		///< nothing started or the samples have been taken
+	ADCConversion_Busy,			///< converting
+	ADCConversion_Done,			///< the samples are ready
+} ADCConversionStateType;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the ADC_Convert state
+/////////////////////////////////////////////////////////////////////////
+static volatile ADCConversionStateType ConversionState;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the ADC_Convert samples
+/////////////////////////////////////////////////////////////////////////
+static uint16_t ConversionSamples[ADC_MAX_CONVERSION_CHANNELS];
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief number of samples in ConversionSamples
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ConversionCount;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief called when the ADC_Convert samples are ready
+/////////////////////////////////////////////////////////////////////////
+static ADCConversionHandlerType ConversionHandler;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief work out the normalise factor for the resolution and alignment
+/// the ADC is set to
+/////////////////////////////////////////////////////////////////////////
+static void CalculateNormaliseFactor(void)
+{
+	uint32_t Bits = 12 - (((ADC1->CFGR1 & ADC_CFGR1_RES) >> 3) * 2);
+	uint32_t FullScale = ((uint32_t)1 << Bits) - 1;
+
+	if ( ADC1->CFGR1 & ADC_CFGR1_ALIGN )
+	{
+		// left aligned to the half word, except the 6 bit samples, which
+		// are aligned to the byte
+		FullScale <<= (Bits > 6 ? 16 : 8) - Bits;
+	}
+
+	NormaliseFactor = (uint32_t)((((uint64_t)NORMALISE_FULL_SCALE << NORMALISE_FRACTION_BITS) + (FullScale / 2)) / FullScale);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief work out the conversion coefficients once, so converting a
+/// sample is a multiply and a shift. The core has no divider.
+/////////////////////////////////////////////////////////////////////////
+static void CalculateCoefficients(void)
+{
+	int32_t Temperature30 = (int32_t)*TEMP30_CAL_ADDR;
+	int32_t CalibrationSpan = (int32_t)*TEMP110_CAL_ADDR - Temperature30;
+
+	// T = ((sample * supply / VDD_CALIB) - TS30) * (110 - 30) / (TS110 - TS30) + 30
+	// The supply part is done by the supply factor, so the slope is for a
+	// sample taken at the calibration supply
+	if ( CalibrationSpan )
+	{
+		TemperatureSlope = ((int32_t)(110 - 30) * 100 << TEMPERATURE_FRACTION_BITS) / CalibrationSpan;
+		TemperatureOffset = (int32_t)(((int64_t)30 * 100 << TEMPERATURE_FRACTION_BITS) -
+							(((int64_t)Temperature30 * (110 - 30) * 100 << TEMPERATURE_FRACTION_BITS) / CalibrationSpan));
+	}
+	else
+	{
+		// blank calibration
+		TemperatureSlope = 0;
+		TemperatureOffset = 0;
+	}
+
+	VrefintCalibration = *VREFINT_CAL_ADDR;
+	NominalSupplyFactor = ((uint32_t)VDD_APPLI << SUPPLY_FRACTION_BITS) / VDD_CALIB;
+
+	if ( !VrefintCalibration || VrefintCalibration > ADC_MAX_SAMPLE )
+	{
+		// blank calibration. Assume the nominal supply
+		VrefintCalibration = (NominalSupplyFactor * ADC_MAX_SAMPLE) >> SUPPLY_FRACTION_BITS;
+	}
+
+	CalculateNormaliseFactor();
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief reset the ADC. Stops anything it was doing at once
+/////////////////////////////////////////////////////////////////////////
+static void ResetAdc(void)
+{
+	RCC->APB2RSTR |= RCC_APB2RSTR_ADCRST;
+	RCC->APB2RSTR &= ~RCC_APB2RSTR_ADCRST;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief an ADC on, off or resolution step took longer than
+/// ADC_TIMEOUT_MS. Reset the ADC and leave it in ADCState_Error
+///
+///	\param context not used
+/////////////////////////////////////////////////////////////////////////
+static void StateTimedOut(void *context)
+{
+	(void)context;
+
+	if ( ADCState_Calibrating == State || ADCState_Enabling == State || ADCState_Disabling == State ||
+		ADCState_Resolving == State )
+	{
+		ResetAdc();
+		State = ADCState_Error;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief start turning the ADC on so that we can read from the temperature
+/// channel. Returns straight away. ADC_Process finishes the job.
+///
+///	\return TRUE started. FALSE the ADC isn't off
+///	\sa ADC_GetState
+/////////////////////////////////////////////////////////////////////////
+uint_fast8_t ADC_On(void)
+{
+	if ( ADCState_Off != State && ADCState_Error != State )
+	{
+		return FALSE;
+	}
+
+	ResetAdc();
+	RCC->APB2ENR |= RCC_APB2ENR_ADCEN;
+
+	ADC->CCR |= ADC_CCR_TSEN | ADC_CCR_VREFEN; // enable the temperature sensor and the reference.
+
+	// calibrate the offset. Must be done while the ADC is disabled
+	ADC1->CR |= ADC_CR_ADCAL;
+
+	Timer_Start(&StateTimer, ADC_TIMEOUT_MS, 0, StateTimedOut, 0);
+	State = ADCState_Calibrating;
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief start turning the ADC off so that it doesn't consume power.
+/// Stops the scan, the watchdog and any conversion. Returns straight away.
+///
+///	\return TRUE started. FALSE the ADC is already off
+///	\sa ADC_GetState
+/////////////////////////////////////////////////////////////////////////
+uint_fast8_t ADC_Off(void)
+{
+	switch ( State )
+	{
+		case ADCState_Off:
+			return FALSE;
+
+		case ADCState_Enabling:
+		case ADCState_Ready:
+			ADC_Scan_Stop();
+			ADC_Watchdog_Stop();
+
+			ADC1->IER &= ~ADC_IER_EOCIE;
+			ConversionState = ADCConversion_Idle;
+
+			// ADDIS = 1: mean that the system is still in the process of turning of the ADC
+			ADC1->CR |= ADC_CR_ADDIS;
+
+			Timer_Start(&StateTimer, ADC_TIMEOUT_MS, 0, StateTimedOut, 0);
+			State = ADCState_Disabling;
+			break;
+
+		default:
+			// calibrating, changing the resolution or stuck. The reset
+			// stops it
+			Timer_Cancel(&StateTimer);
+			ResetAdc();
+			State = ADCState_Off;
+			break;
+	}
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief move the ADC on, off and resolution changes along. Call from
+/// the main loop. Never waits on the ADC. A step that takes longer than
+/// ADC_TIMEOUT_MS resets the ADC and leaves it in ADCState_Error through
+/// StateTimedOut.
+/////////////////////////////////////////////////////////////////////////
+void ADC_Process(void)
+{
+	switch ( State )
+	{
+		case ADCState_Calibrating:
+			if ( !(ADC1->CR & ADC_CR_ADCAL) )
+			{
+				// enable ADC
+				ADC1->CR |= ADC_CR_ADEN;
+
+				Timer_Start(&StateTimer, ADC_TIMEOUT_MS, 0, StateTimedOut, 0);
+				State = ADCState_Enabling;
+			}
+			break;
+
+		case ADCState_Enabling:
+			// the ADC is ready to start conversion
+			if ( ADC1->ISR & ADC_ISR_ADRDY )
+			{
+				// the overrun, watchdog and conversion interrupts. Same level
+				// as the DMA interrupt so they never preempt each other
+				NVIC_SetPriority(ADC1_IRQn, 0);
+				NVIC_EnableIRQ(ADC1_IRQn);
+
+				CalculateCoefficients();
+
+				Timer_Cancel(&StateTimer);
+				State = ADCState_Ready;
+			}
+			break;
+
+		case ADCState_Disabling:
+			if ( !(ADC1->CR & ADC_CR_ADEN) )
+			{
+				Timer_Cancel(&StateTimer);
+				State = ADCState_Off;
+			}
+			break;
+
+		case ADCState_Resolving:
+			if ( !(ADC1->CR & ADC_CR_ADEN) )
+			{
+				// disabled. The resolution can only be changed now
+				ADC1->CFGR1 = (ADC1->CFGR1 & ~ADC_CFGR1_RES) | PendingResolution;
+				ADC1->CR |= ADC_CR_ADEN;
+			}
+			else if ( ADC1->ISR & ADC_ISR_ADRDY )
+			{
+				CalculateNormaliseFactor();
+
+				Timer_Cancel(&StateTimer);
+				State = ADCState_Ready;
+
+				if ( StartWhenReady )
+				{
+					StartWhenReady = FALSE;
+					ADC1->CR |= ADC_CR_ADSTART;
+				}
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the ADC state
+/////////////////////////////////////////////////////////////////////////
+ADCStateType ADC_GetState(void)
+{
+	return State;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return how long the core can sleep. The on and off steps are
+/// polled and take microseconds, so there is no sleeping through them.
+///
+///	\return 0 = ADC_Process has work. TICK_IDLE_FOREVER = the rest is
+///	done by interrupts
+/////////////////////////////////////////////////////////////////////////
+uint32_t ADC_GetIdleMs(void)
+{
+	if ( ADCState_Calibrating == State || ADCState_Enabling == State || ADCState_Disabling == State ||
+		ADCState_Resolving == State )
+	{
+		return 0;
+	}
+
+	return TICK_IDLE_FOREVER;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief work out the profile the ADC has to use for a set of channels.
+/// The longest sampling time, the most bits, and left alignment only when
+/// every channel asks for it
+///
+///	\param channelMask bit n set is channel n. Must be a valid mask
+///	\param combined where to put the profile
+///
+///	\return number of channels in the mask
+/////////////////////////////////////////////////////////////////////////
+static uint32_t CombineProfiles(uint32_t channelMask, ADCProfileType *combined)
+{
+	const ADCProfileType *Profile;
+	uint32_t ChannelCount = 0;
+	uint32_t Channel;
+
+	combined->SampleTime = ADCSampleTime_1_5;
+	combined->Resolution = ADCResolution_6Bit;
+	combined->Alignment = ADCAlign_Left;
+
+	for ( Channel = 0; channelMask; Channel++, channelMask >>= 1 )
+	{
+		if ( !(channelMask & 1) )
+		{
+			continue;
+		}
+
+		Profile = &Profiles[Channel];
+		ChannelCount++;
+
+		if ( Profile->SampleTime > combined->SampleTime )
+		{
+			combined->SampleTime = Profile->SampleTime;
+		}
+
+		if ( Profile->Resolution < combined->Resolution )
+		{
+			combined->Resolution = Profile->Resolution;
+		}
+
+		if ( ADCAlign_Right == Profile->Alignment )
+		{
+			combined->Alignment = ADCAlign_Right;
+		}
+	}
+
+	return ChannelCount;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief set the ADC up for a set of channels. Nothing may be converting.
+/// The resolution can only be changed while the ADC is disabled, so a new
+/// one moves the ADC to ADCState_Resolving and ADC_Process does it.
+///
+///	\param channelMask bit n set is channel n. Must be a valid mask
+///
+///	\return half ADC clocks taken by one conversion of every channel
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ApplyProfiles(uint32_t channelMask)
+{
+	ADCProfileType Combined;
+	uint32_t ChannelCount = CombineProfiles(channelMask, &Combined);
+	uint32_t Resolution = (uint32_t)Combined.Resolution << 3;
+
+	if ( ADCAlign_Left == Combined.Alignment )
+	{
+		ADC1->CFGR1 |= ADC_CFGR1_ALIGN;
+	}
+	else
+	{
+		ADC1->CFGR1 &= ~ADC_CFGR1_ALIGN;
+	}
+
+	ADC1->SMPR = Combined.SampleTime;
+
+	if ( Resolution != (ADC1->CFGR1 & ADC_CFGR1_RES) )
+	{
+		PendingResolution = Resolution;
+
+		ADC1->ISR = ADC_ISR_ADRDY;
+		ADC1->CR |= ADC_CR_ADDIS;
+
+		Timer_Start(&StateTimer, ADC_TIMEOUT_MS, 0, StateTimedOut, 0);
+		State = ADCState_Resolving;
+	}
+	else
+	{
+		CalculateNormaliseFactor();
+	}
+
+	return ChannelCount * (SampleHalfCycles[Combined.SampleTime] + ConversionHalfCycles[Combined.Resolution]);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief start converting. While the resolution is changing the start
+/// is left to ADC_Process
+/////////////////////////////////////////////////////////////////////////
+static void StartConversion(void)
+{
+	if ( ADCState_Resolving == State )
+	{
+		StartWhenReady = TRUE;
+	}
+	else
+	{
+		ADC1->CR |= ADC_CR_ADSTART;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief set how a channel is converted. Used from the next scan or
+/// conversion that includes the channel.
+///
+///	The temperature sensor and VREFINT must stay at 12 bits right aligned
+///	with at least 71.5 cycles of sampling, as the conversions to degrees
+///	and millivolts expect.
+///
+///	\param channel the ADC channel
+///	\param profile the profile
+///
+///	\return TRUE success. FALSE bad channel or profile
+///	ERROR_INVALID_POINTER = Invalid profile pointer
+/////////////////////////////////////////////////////////////////////////
+int_fast8_t ADC_SetProfile(uint32_t channel, const ADCProfileType *profile)
+{
+	if ( !profile )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	if ( channel >= ADC_NUMBER_OF_CHANNELS || (uint32_t)profile->SampleTime > ADCSampleTime_239_5 ||
+		(uint32_t)profile->Resolution > ADCResolution_6Bit || (uint32_t)profile->Alignment > ADCAlign_Left )
+	{
+		return FALSE;
+	}
+
+	if ( channel >= ADC_TEMPERATURE_CHANNEL &&
+		( profile->SampleTime < ADCSampleTime_71_5 || ADCResolution_12Bit != profile->Resolution ||
+		ADCAlign_Right != profile->Alignment ) )
+	{
+		return FALSE;
+	}
+
+	Profiles[channel] = *profile;
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief copy how a channel is converted
+///
+///	\param channel the ADC channel
+///	\param destination where to copy the profile
+///
+///	\return TRUE success. FALSE bad channel
+///	ERROR_INVALID_POINTER = Invalid destination pointer
+/////////////////////////////////////////////////////////////////////////
+int_fast8_t ADC_GetProfile(uint32_t channel, ADCProfileType *destination)
+{
+	if ( !destination )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	if ( channel >= ADC_NUMBER_OF_CHANNELS )
+	{
+		return FALSE;
+	}
+
+	*destination = Profiles[channel];
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the fastest a set of channels can be scanned with their
+/// profiles. Back to back conversions, as the continuous scan does
+///
+///	\param channelMask bit n set is channel n
+///
+///	\return scans per second. 0 = bad mask
+/////////////////////////////////////////////////////////////////////////
+uint32_t ADC_ReturnMaxScanRate(uint32_t channelMask)
+{
+	ADCProfileType Combined;
+	uint32_t ChannelCount;
+
+	if ( !channelMask || (channelMask >> ADC_NUMBER_OF_CHANNELS) )
+	{
+		return 0;
+	}
+
+	ChannelCount = CombineProfiles(channelMask, &Combined);
+
+	return ((uint32_t)ADC_CLOCK_HZ * 2) /
+		(ChannelCount * (SampleHalfCycles[Combined.SampleTime] + ConversionHalfCycles[Combined.Resolution]));
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief start converting one or more channels, once each. Returns
+/// straight away. The samples are taken by the ADC interrupt at the end of
+/// each conversion.
+///
+///	\param channelMask bit n set converts channel n. Up to
+///	ADC_MAX_CONVERSION_CHANNELS channels
+///	\param handler called from the ADC interrupt once all the channels are
+///	converted. 0 = none, poll ADC_GetConversion instead
+///
+///	\return TRUE started. FALSE the ADC isn't ready, is busy or bad mask
+///	\sa ADC_SetProfile
+/////////////////////////////////////////////////////////////////////////
+uint_fast8_t ADC_Convert(uint32_t channelMask, ADCConversionHandlerType handler)
+{
+	uint32_t ChannelCount = 0;
+	uint32_t Mask;
+
+	if ( ADCState_Ready != State || ADCConversion_Busy == ConversionState || ScanChannelCount ||
+		(ADC1->CR & ADC_CR_ADSTART) || !channelMask || (channelMask >> ADC_NUMBER_OF_CHANNELS) )
+	{
+		return FALSE;
+	}
+
+	for ( Mask = channelMask; Mask; Mask &= Mask - 1 )
+	{
+		ChannelCount++;
+	}
+
+	if ( ChannelCount > ADC_MAX_CONVERSION_CHANNELS )
+	{
+		return FALSE;
+	}
+
+	ApplyProfiles(channelMask);
+
+	ConversionCount = 0;
+	ConversionHandler = handler;
+	ConversionState = ADCConversion_Busy;
+
+	// converted in channel number order
+	ADC1->CHSELR = channelMask;
+	ADC1->ISR = ADC_ISR_EOC | ADC_ISR_EOSEQ | ADC_ISR_OVR;
+	ADC1->IER |= ADC_IER_EOCIE;
+
+	StartConversion();
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief take the samples of the conversion started by ADC_Convert.
+///
+///	\param destination where to copy the samples, in channel number order.
+///	Must hold ADC_MAX_CONVERSION_CHANNELS samples
+///
+///	\return number of samples copied. 0 = still converting
+///	ERROR = no conversion started or invalid destination pointer
+/////////////////////////////////////////////////////////////////////////
+int_fast8_t ADC_GetConversion(uint16_t *destination)
+{
+	uint32_t Index;
+
+	if ( !destination || ADCConversion_Idle == ConversionState )
+	{
+		return ERROR;
+	}
+
+	if ( ADCConversion_Done != ConversionState )
+	{
+		return 0;
+	}
+
+	// make sure we don't read the samples before the done state
+	MEMORY_BARRIER();
+
+	for ( Index = 0; Index < ConversionCount; Index++ )
+	{
+		destination[Index] = ConversionSamples[Index];
+	}
+
+	ConversionState = ADCConversion_Idle;
+
+	return (int_fast8_t)ConversionCount;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the adc value as a fraction of the full scale.
+///
+///	\param rawData the ADC raw data
+///
+///	\return the normalised value in parts per million
+///	\sa ADC_Convert()
+/////////////////////////////////////////////////////////////////////////
+uint32_t ADC_ReturnNormalised(uint_fast16_t rawData)
+{
+	return ((uint32_t)rawData * NormaliseFactor + ((uint32_t)1 << (NORMALISE_FRACTION_BITS - 1))) >> NORMALISE_FRACTION_BITS;
+}
+
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the supply compensation factor for a VREFINT sample.
+/// Work it out once per scan and use it for every channel of that scan.
+///
+///	\param vrefintData the VREFINT sample
+///
+///	\return the calibration supply over the real supply. SUPPLY_FRACTION_BITS
+///	fraction bits
+/////////////////////////////////////////////////////////////////////////
+uint32_t ADC_ReturnSupplyFactor(uint_fast16_t vrefintData)
+{
+	if ( !vrefintData )
+	{
+		return NominalSupplyFactor;
+	}
+
+	// the only division of the scan
+	return ((VrefintCalibration << SUPPLY_FRACTION_BITS) + (vrefintData / 2)) / vrefintData;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the supply voltage
+///
+///	\param supplyFactor the factor from ADC_ReturnSupplyFactor
+///
+///	\return the supply in millivolts
+/////////////////////////////////////////////////////////////////////////
+uint32_t ADC_ReturnSupplyMillivolts(uint32_t supplyFactor)
+{
+	return ((uint32_t)VDD_CALIB * 10 * supplyFactor + ((uint32_t)1 << (SUPPLY_FRACTION_BITS - 1))) >> SUPPLY_FRACTION_BITS;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the converted/calibrated temperature reading
+///
+///	\param rawData the ADC raw data for the temperature sensor.
+///	\param supplyFactor the factor from ADC_ReturnSupplyFactor for the same
+///	scan
+///
+///	\return the temperature in centi-degrees Celsius
+///	\sa ADC_Convert()
+/////////////////////////////////////////////////////////////////////////
+int32_t ADC_ReturnCompensatedTemperature(uint_fast16_t rawData, uint32_t supplyFactor)
+{
+	// the sample the sensor would have given at the calibration supply
+	uint32_t Sample = ((uint32_t)rawData * supplyFactor + ((uint32_t)1 << (SUPPLY_FRACTION_BITS - 1))) >> SUPPLY_FRACTION_BITS;
+
+	// keeps the slope multiply within an int32
+	if ( Sample > ADC_MAX_SAMPLE )
+	{
+		Sample = ADC_MAX_SAMPLE;
+	}
+
+	// round to the nearest centi-degree
+	return ((int32_t)Sample * TemperatureSlope + TemperatureOffset + ((int32_t)1 << (TEMPERATURE_FRACTION_BITS - 1))) >> TEMPERATURE_FRACTION_BITS;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the converted/calibrated temperature reading assuming
+/// the supply is VDD_APPLI
+///
+///	\param rawData the ADC raw data for the temperature sensor.
+///
+///	\return the temperature in centi-degrees Celsius
+///	\sa ADC_Convert()
+/////////////////////////////////////////////////////////////////////////
+int32_t ADC_ReturnCalibratedTemperature(uint_fast16_t rawData)
+{
+	return ADC_ReturnCompensatedTemperature(rawData, NominalSupplyFactor);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief stop any conversion and the DMA
+/////////////////////////////////////////////////////////////////////////
+static void StopConversion(void)
+{
+	if ( ADC1->CR & ADC_CR_ADSTART )
+	{
+		ADC1->CR |= ADC_CR_ADSTP;
+		// takes a few ADC clocks
+		while ( ADC1->CR & ADC_CR_ADSTP );
+	}
+
+	StartWhenReady = FALSE;
+
+	ADC_DMA_CHANNEL->CCR = 0;
+	ADC1->ISR = ADC_ISR_OVR | ADC_ISR_EOC | ADC_ISR_EOSEQ;
+	DMA1->IFCR = DMA_IFCR_CGIF1;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief stop the conversion started by ADC_Convert. ADC_GetConversion
+/// then returns ERROR. Does nothing if none is running
+/////////////////////////////////////////////////////////////////////////
+void ADC_CancelConversion(void)
+{
+	if ( ADCConversion_Busy != ConversionState || ScanChannelCount )
+	{
+		return;
+	}
+
+	// the interrupt can't finish it once EOCIE is clear
+	ADC1->IER &= ~ADC_IER_EOCIE;
+	StopConversion();
+
+	ConversionState = ADCConversion_Idle;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief point the DMA at the start of the scan buffer, ready for the
+/// first conversion
+/////////////////////////////////////////////////////////////////////////
+static void ArmDma(void)
+{
+	ADC_DMA_CHANNEL->CPAR = (uint32_t)&ADC1->DR;
+	ADC_DMA_CHANNEL->CMAR = (uint32_t)&ScanBuffer[0];
+	ADC_DMA_CHANNEL->CNDTR = ScanLength;
+	// very high priority. A late transfer is an overrun
+	ADC_DMA_CHANNEL->CCR = DMA_CCR_PL | DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE;
+	ADC_DMA_CHANNEL->CCR |= DMA_CCR_EN;
+}
 
 /////////////////////////////////////////////////////////////////////////
-/// \brief enables the ADC so that we can read from the temperature channel
+/// \brief start the stopped scan again from the first channel
+///
+///	\param wasConverting FALSE a software mode scan wasn't running. Wait
+///	for the next ADC_Scan_Trigger
 /////////////////////////////////////////////////////////////////////////
-void ADC_On(void)
+static void RestartScan(uint32_t wasConverting)
 {
-	RCC->APB2RSTR |= RCC_APB2RSTR_ADCRST;
-	RCC->APB2RSTR &= ~RCC_APB2RSTR_ADCRST;
-	RCC->APB2ENR |= RCC_APB2ENR_ADCEN;
-
-	ADC->CCR |= ADC_CCR_TSEN; // enable the temperature sensor.
+	// make any ADC_Scan_GetLatest in progress copy again
+	ScanSequence += 2;
 
-	// enable ADC
-	ADC1->CR |= ADC_CR_ADEN;
-	// wait until the ADC is ready to start conversion
-	while ( ! ADC1->ISR & ADC_ISR_ADRDY ) ;
+	ArmDma();
 
+	if ( wasConverting || (ADC1->CFGR1 & (ADC_CFGR1_CONT | ADC_CFGR1_EXTEN)) )
+	{
+		StartConversion();
+	}
 }
 
 /////////////////////////////////////////////////////////////////////////
-/// \brief disable the ADC and ensure that it doesn't consume power
+/// \brief run the block handlers on the newest block. Deferred from the
+/// DMA interrupt to PendSV, so the handlers don't hold up the other
+/// interrupts. If the DMA interrupt gets in while the block is being
+/// copied, the newer block is taken. A block overwritten before it was
+/// taken shows as a sequence gap.
 /////////////////////////////////////////////////////////////////////////
-void ADC_Off(void)
+static void ProcessBlock(void)
 {
-	ADC1->CR |= ADC_CR_ADDIS;
-	// wait until the ADC is disable. ADDIS = 1: mean that the system is still in the process of turning of the ADC
-	while( ADC1->CR & ADC_CR_ADDIS );
+	ADCBlockType Block;
+	ADCBlockHandlerType Handler;
+	uint32_t Index;
+
+	if ( !PendingBlockReady )
+	{
+		return;
+	}
+
+	do
+	{
+		PendingBlockReady = FALSE;
+		MEMORY_BARRIER();
+
+		Block = PendingBlock;
+
+		MEMORY_BARRIER();
+	} while ( PendingBlockReady );
+
+	for ( Index = 0; Index < ADC_MAX_BLOCK_HANDLERS; Index++ )
+	{
+		Handler = BlockHandler[Index];
+
+		if ( Handler )
+		{
+			Handler(&Block);
+		}
+	}
 
+	Event_Post(Event_Scan);
 }
 
 /////////////////////////////////////////////////////////////////////////
-/// \brief reads the raw adc value from the select channel.
+/// \brief start converting a set of channels into the scan buffer
 ///
-///	\param channel the ADC channel to select range 0 to 17
-///	\param destination pointer to return the read value
+///	\param channelMask bit n set converts channel n
+///	\param mode continuous or one scan per ADC_Scan_Trigger
 ///
-///	\return true on success else adc is not open
+///	\return TRUE success. FALSE the ADC is off, the mask is invalid or the
+///	timer rate is faster than the channel profiles allow
+///	\sa ADC_SetProfile
 /////////////////////////////////////////////////////////////////////////
-uint_fast8_t ADC_Read(uint_fast32_t channel, uint_fast16_t * destination)
+uint_fast8_t ADC_Scan_Start(uint32_t channelMask, ADCScanModeType mode)
 {
-	// Check that the ADC is on
-	if(!(ADC1->CR & ADC_CR_ADEN) || channel > 17 || !destination )
+	uint32_t VectorsPerHalf;
+	uint32_t ChannelCount = 0;
+	uint32_t Mask;
+
+	if ( ADCState_Ready != State || ADCConversion_Busy == ConversionState ||
+		!channelMask || (channelMask >> ADC_NUMBER_OF_CHANNELS) )
 	{
 		return FALSE;
 	}
 
-	// check to see if the ADC is already running, if so return false
-	if (ADC1->CR & ADC_CR_ADSTART)
+	for ( Mask = channelMask; Mask; Mask &= Mask - 1 )
+	{
+		ChannelCount++;
+	}
+
+	// a trigger arriving while the last scan is still converting is lost
+	if ( ADCScanMode_Timer == mode && ( !ScanRate || ScanRate > ADC_ReturnMaxScanRate(channelMask) ) )
 	{
 		return FALSE;
 	}
 
-	// select channel
-	ADC1->CHSELR = ((uint32_t)(1 << channel));
+	ADC_Scan_Stop();
 
-	// start the conversion
-	ADC1->CR |= ADC_CR_ADSTART;
+	ScanHalfCycles = ApplyProfiles(channelMask);
+
+	// whole vectors in each half so a half is always a complete block
+	VectorsPerHalf = (ADC_SCAN_BUFFER_SIZE / 2) / ChannelCount;
+	ScanLength = VectorsPerHalf * ChannelCount * 2;
+	ScanSequence = 0;
+
+	// the channels are converted in channel number order
+	ADC1->CHSELR = channelMask;
+	ADC1->CFGR1 &= ~(ADC_CFGR1_CONT | ADC_CFGR1_EXTEN | ADC_CFGR1_SCANDIR);
+	ADC1->CFGR1 |= ADC_CFGR1_DMAEN | ADC_CFGR1_DMACFG;
+
+	if ( ADCScanMode_Continuous == mode )
+	{
+		ADC1->CFGR1 |= ADC_CFGR1_CONT;
+	}
+	else if ( ADCScanMode_Timer == mode )
+	{
+		// start a scan on the timer TRGO rising edge
+		ADC1->CFGR1 = (ADC1->CFGR1 & ~ADC_CFGR1_EXTSEL) | ADC_TRIGGER_SELECT | ADC_CFGR1_EXTEN_0;
+	}
 
-	// wait until ADC is done with conversion
-	while(!(ADC1->ISR & ADC_ISR_EOC) ) ;
+	RCC->AHBENR |= RCC_AHBENR_DMA1EN;
 
-	*destination = (uint32_t)(0x0000FFFF & ADC1->DR);
+	Event_SetDeferredHandler(EventDeferred_ScanBlock, ProcessBlock);
+
+	// same level as the ADC interrupt so they never preempt each other
+	NVIC_SetPriority(DMA1_Channel1_IRQn, 0);
+	NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+	ADC1->IER |= ADC_IER_OVRIE;
+
+	ScanChannelCount = ChannelCount;
+	ScanChannelMask = channelMask;
+
+	ArmDma();
+
+	// in the software mode each ADC_Scan_Trigger converts one vector. In
+	// the timer mode ADSTART arms the trigger
+	if ( ADCScanMode_Software != mode )
+	{
+		StartConversion();
+	}
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief stop the scan and give the ADC back to ADC_Convert
+/////////////////////////////////////////////////////////////////////////
+void ADC_Scan_Stop(void)
+{
+	NVIC_DisableIRQ(DMA1_Channel1_IRQn);
+
+	ADC1->IER &= ~ADC_IER_OVRIE;
+
+	StopConversion();
+
+	ADC1->CFGR1 &= ~(ADC_CFGR1_CONT | ADC_CFGR1_EXTEN | ADC_CFGR1_DMAEN | ADC_CFGR1_DMACFG);
+
+	ScanChannelCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief start one scan in the software mode. Doesn't wait for it
+///
+///	\return TRUE started. FALSE the scan is stopped or still converting
+/////////////////////////////////////////////////////////////////////////
+uint_fast8_t ADC_Scan_Trigger(void)
+{
+	if ( !ScanChannelCount || ADCState_Ready != State || (ADC1->CR & ADC_CR_ADSTART) )
+	{
+		return FALSE;
+	}
+
+	ADC1->CR |= ADC_CR_ADSTART;
 
 	return TRUE;
 }
 
 /////////////////////////////////////////////////////////////////////////
-/// \brief return the normalized adc value from the select channel.
+/// \brief set the timer mode scan rate. The timer runs from the core clock
+/// so the rate is exact to the crystal, with no software in the path.
+///
+///	\param rate scans per second
+///
+///	\return the rate really achieved in millihertz. 0 = out of range
+/////////////////////////////////////////////////////////////////////////
+uint32_t ADC_Scan_SetRate(uint32_t rate)
+{
+	uint32_t Ticks;
+	uint32_t Prescaler;
+	uint32_t Reload;
+
+	// the scan in progress must finish before the next trigger. Without a
+	// scan ADC_Scan_Start checks it against the channels it is given
+	if ( !rate || (ScanChannelCount && ((uint64_t)rate * ScanHalfCycles) > ((uint64_t)ADC_CLOCK_HZ * 2)) )
+	{
+		return 0;
+	}
+
+	// timer clocks per scan, split into the smallest prescaler that lets the
+	// reload fit so the rate is as close as possible
+	Ticks = (SystemCoreClock + (rate / 2)) / rate;
+	Prescaler = ((Ticks - 1) / TIMER_MAX_COUNT) + 1;
+	Reload = (Ticks + (Prescaler / 2)) / Prescaler;
+
+	RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+
+	ADC_TRIGGER_TIMER->CR1 = TIM_CR1_ARPE;
+	ADC_TRIGGER_TIMER->PSC = Prescaler - 1;
+	ADC_TRIGGER_TIMER->ARR = Reload - 1;
+	// the update event is the TRGO
+	ADC_TRIGGER_TIMER->CR2 = TIM_CR2_MMS_1;
+	ADC_TRIGGER_TIMER->EGR = TIM_EGR_UG;
+	ADC_TRIGGER_TIMER->CR1 |= TIM_CR1_CEN;
+
+	ScanRate = rate;
+
+	return (uint32_t)(((uint64_t)SystemCoreClock * 1000) / ((uint64_t)Prescaler * Reload));
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief copy the last complete scan vector. Never waits for the ADC.
 ///
-///	\param ADC channel
-///	\param destination pointer to return the read value
+///	The vector behind the DMA position is complete and the DMA can't get
+///	back to it before it has been round the whole buffer, which takes two
+///	half buffer interrupts. So the copy is only retried when the DMA lapped
+///	us while copying.
 ///
-///	\return true on success else adc is not open
+///	\param destination where to copy the vector. Must hold
+///	ADC_Scan_GetChannelCount samples
+///
+///	\return number of samples copied. 0 = no vector yet or scan stopped
 /////////////////////////////////////////////////////////////////////////
-uint_fast8_t ADC_ReadNorm(uint_fast32_t channel, float * destination)
+uint32_t ADC_Scan_GetLatest(uint16_t *destination)
 {
-	uint_fast8_t Status = ERROR;
-	uint_fast16_t ADCSample;
-	uint32_t ADCResolution;
+	uint32_t ChannelCount = ScanChannelCount;
+	uint32_t Sequence;
+	uint32_t Position;
+	uint32_t Index;
+
+	if ( !ChannelCount || !destination )
+	{
+		return 0;
+	}
 
-	if (destination){
-		Status = ADC_Read(channel, &ADCSample);
+	do
+	{
+		Sequence = ScanSequence;
+		MEMORY_BARRIER();
 
-		if (TRUE == Status){
+		// start of the vector being converted
+		Position = ScanLength - ADC_DMA_CHANNEL->CNDTR;
+		Position -= Position % ChannelCount;
 
-			if(0 != ADCSample) {
-				ADCResolution = ((uint32_t)12 - (((uint32_t)(ADC1->CFGR1 & ADC_CFGR1_RES) >> 3) * 2));
-				ADCResolution = ((uint32_t)(1 << ADCResolution))-1;
-				*destination = ((float)ADCSample/ADCResolution);
-			} else {
-				*destination = 0;
+		if ( !Position )
+		{
+			if ( !Sequence )
+			{
+				// nothing converted yet
+				return 0;
 			}
+
+			// the last vector is at the end of the buffer
+			Position = ScanLength;
+		}
+
+		Position -= ChannelCount;
+
+		for ( Index = 0; Index < ChannelCount; Index++ )
+		{
+			destination[Index] = ScanBuffer[Position + Index];
+		}
+
+		MEMORY_BARRIER();
+	} while ( (ScanSequence - Sequence) >= 2 );
+
+	return ChannelCount;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the number of samples in a scan vector. 0 = scan stopped
+/////////////////////////////////////////////////////////////////////////
+uint32_t ADC_Scan_GetChannelCount(void)
+{
+	return ScanChannelCount;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the channels in a scan vector. Bit n set = channel n.
+/// 0 = scan stopped
+/////////////////////////////////////////////////////////////////////////
+uint32_t ADC_Scan_GetChannelMask(void)
+{
+	return ScanChannelCount ? ScanChannelMask : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief add a function to call for every complete block. The handlers
+/// are called in the order of their slots.
+///
+///	\param handler the block handler
+///
+///	\return TRUE added or already there. FALSE all ADC_MAX_BLOCK_HANDLERS
+///	slots are taken. ERROR_INVALID_POINTER = Invalid handler pointer
+///	\sa ADCBlockHandlerType
+/////////////////////////////////////////////////////////////////////////
+int_fast8_t ADC_Scan_AddBlockHandler(ADCBlockHandlerType handler)
+{
+	uint32_t Index;
+	uint32_t FreeIndex = ADC_MAX_BLOCK_HANDLERS;
+
+	if ( !handler )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	for ( Index = 0; Index < ADC_MAX_BLOCK_HANDLERS; Index++ )
+	{
+		if ( handler == BlockHandler[Index] )
+		{
+			return TRUE;
+		}
+
+		if ( !BlockHandler[Index] && ADC_MAX_BLOCK_HANDLERS == FreeIndex )
+		{
+			FreeIndex = Index;
 		}
 	}
 
-	return Status;
+	if ( ADC_MAX_BLOCK_HANDLERS == FreeIndex )
+	{
+		return FALSE;
+	}
+
+	// the handler must see its state set up before it is called
+	MEMORY_BARRIER();
+
+	// one word write, so the interrupt sees the slot empty or set
+	BlockHandler[FreeIndex] = handler;
+
+	return TRUE;
 }
 
-/* Temperature sensor calibration value address */
-#define TEMP110_CAL_ADDR ((uint16_t*) ((uint32_t) 0x1FFFF7C2))
-#define TEMP30_CAL_ADDR ((uint16_t*) ((uint32_t) 0x1FFFF7B8))
-#define VDD_CALIB ((uint16_t) (330))
-#define VDD_APPLI ((uint16_t) (300))
+/////////////////////////////////////////////////////////////////////////
+/// \brief stop calling a block handler. Once this returns the handler
+/// isn't running and won't be called again.
+///
+///	\param handler the block handler
+/////////////////////////////////////////////////////////////////////////
+void ADC_Scan_RemoveBlockHandler(ADCBlockHandlerType handler)
+{
+	uint32_t Index;
 
+	for ( Index = 0; Index < ADC_MAX_BLOCK_HANDLERS; Index++ )
+	{
+		if ( handler == BlockHandler[Index] )
+		{
+			BlockHandler[Index] = 0;
+		}
+	}
+
+	// the interrupt preempts the main loop, so it is not in the handler
+	MEMORY_BARRIER();
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the DMA channel 1 interrupt handler. Half of the scan buffer is
+/// complete. Only notes the block. ProcessBlock does the rest
+/////////////////////////////////////////////////////////////////////////
+void DMA1_Channel1_IRQHandler(void)
+{
+	uint32_t Status = DMA1->ISR;
+
+	DMA1->IFCR = DMA_IFCR_CGIF1;
+
+	if ( Status & DMA_ISR_TCIF1 )
+	{
+		PendingBlock.Samples = &ScanBuffer[ScanLength / 2];
+	}
+	else if ( Status & DMA_ISR_HTIF1 )
+	{
+		PendingBlock.Samples = &ScanBuffer[0];
+	}
+	else
+	{
+		return;
+	}
+
+	PendingBlock.TimestampUs = Tick_GetUs();
+	PendingBlock.TimestampMs = Tick_GetMs();
+	PendingBlock.NumberOfVectors = (ScanLength / 2) / ScanChannelCount;
+	PendingBlock.NumberOfChannels = ScanChannelCount;
+	PendingBlock.ChannelMask = ScanChannelMask;
+	PendingBlock.Sequence = ScanSequence++;
+
+	PendingBlockReady = TRUE;
+	Event_Defer(EventDeferred_ScanBlock);
+}
 
 /////////////////////////////////////////////////////////////////////////
-/// \brief return the converted/calibrated temperature reading in Degree
+/// \brief scale a sample of the resolution and alignment the ADC is set
+/// to up to 12 bits right aligned, as the watchdog thresholds are
 ///
-///	\param rawData the ADC raw data for the temperature sensor.
+///	\param sample the sample
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ReturnTwelveBitSample(uint32_t sample)
+{
+	uint32_t Resolution = (ADC1->CFGR1 & ADC_CFGR1_RES) >> 3;
+
+	if ( ADC1->CFGR1 & ADC_CFGR1_ALIGN )
+	{
+		// the 6 bit samples are aligned to the byte
+		return (ADCResolution_6Bit == Resolution) ? (sample << 4) : (sample >> 4);
+	}
+
+	return sample << (Resolution * 2);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the last sample of the watched channel in the scan
+/// buffer. The DMA takes each sample out of the data register as soon as
+/// it is converted, so it is there by the time the interrupt runs.
+/////////////////////////////////////////////////////////////////////////
+static uint32_t ReturnWatchedScanSample(void)
+{
+	uint32_t Below = ADC1->CHSELR & (((uint32_t)1 << ((ADC1->CFGR1 & ADC_CFGR1_AWDCH) >> 26)) - 1);
+	uint32_t Written = ScanLength - ADC_DMA_CHANNEL->CNDTR;
+	uint32_t Position = 0;
+
+	// the channels are converted in channel number order, so its place in
+	// the vector is the number of channels below it
+	while ( Below )
+	{
+		Below &= Below - 1;
+		Position++;
+	}
+
+	// in the vector being written, or else in the one before
+	Position += Written - (Written % ScanChannelCount);
+
+	if ( Position >= Written )
+	{
+		Position += ScanLength - ScanChannelCount;
+
+		if ( Position >= ScanLength )
+		{
+			Position -= ScanLength;
+		}
+	}
+
+	return ScanBuffer[Position];
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the watchdog went off. Move the alarm state on and set the
+/// window for leaving the new state, so the thresholds have hysteresis
+/// without any work per sample
+///
+///	\param sample the conversion of the watched channel
+/////////////////////////////////////////////////////////////////////////
+static void WatchdogEvent(uint32_t sample)
+{
+	uint32_t Sample;
+	ADCAlarmStateType NewState = ADCAlarm_Off;
+
+	if ( ADCAlarm_Off == AlarmState )
+	{
+		// the window is left either way
+		Sample = ReturnTwelveBitSample(sample);
+
+		if ( Sample > WatchdogHigh )
+		{
+			NewState = ADCAlarm_High;
+		}
+		else if ( Sample < WatchdogLow )
+		{
+			NewState = ADCAlarm_Low;
+		}
+		else
+		{
+			return;
+		}
+	}
+
+	switch ( NewState )
+	{
+		case ADCAlarm_High:
+			ADC1->TR = ((uint32_t)ADC_MAX_SAMPLE << 16) | (WatchdogHigh - WatchdogHysteresis);
+			break;
+
+		case ADCAlarm_Low:
+			ADC1->TR = ((WatchdogLow + WatchdogHysteresis) << 16);
+			break;
+
+		default:
+			ADC1->TR = (WatchdogHigh << 16) | WatchdogLow;
+			break;
+	}
+
+	AlarmState = NewState;
+	AlarmTimestampMs = Tick_GetMs();
+	MEMORY_BARRIER();
+	AlarmChangeCount++;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief watch a channel and raise an alarm when it goes outside the
+/// window. Needs conversions of the channel, from a scan or ADC_Convert.
 ///
-///	\return returns the converted value
-///	\sa ADC_Read()
+///	The alarm clears when the channel comes back inside the window by
+///	hysteresis counts. The window is in 12 bit counts whatever the channel
+///	profile, the ADC compares the top bits of lower resolution samples.
+///
+///	\param channel the ADC channel to watch
+///	\param low the lowest sample inside the window
+///	\param high the highest sample inside the window
+///	\param hysteresis counts back inside the window to clear the alarm
+///
+///	\return TRUE success. FALSE the ADC is off or bad parameters
+/////////////////////////////////////////////////////////////////////////
+uint_fast8_t ADC_Watchdog_Start(uint32_t channel, uint32_t low, uint32_t high, uint32_t hysteresis)
+{
+	uint32_t WasConverting;
+
+	if ( ADCState_Ready != State || ADCConversion_Busy == ConversionState ||
+		channel >= ADC_NUMBER_OF_CHANNELS || low > high ||
+		high > ADC_MAX_SAMPLE || hysteresis > high || (low + hysteresis) > ADC_MAX_SAMPLE )
+	{
+		return FALSE;
+	}
+
+	// the watchdog channel can only be changed while the ADC is stopped
+	WasConverting = ADC1->CR & ADC_CR_ADSTART;
+	StopConversion();
+
+	ADC1->IER &= ~ADC_IER_AWDIE;
+
+	WatchdogLow = low;
+	WatchdogHigh = high;
+	WatchdogHysteresis = hysteresis;
+	AlarmState = ADCAlarm_Off;
+
+	ADC1->TR = (high << 16) | low;
+	ADC1->CFGR1 = (ADC1->CFGR1 & ~ADC_CFGR1_AWDCH) | (channel << 26) | ADC_CFGR1_AWDSGL | ADC_CFGR1_AWDEN;
+	ADC1->ISR = ADC_ISR_AWD;
+	ADC1->IER |= ADC_IER_AWDIE;
+
+	if ( ScanChannelCount )
+	{
+		RestartScan(WasConverting);
+	}
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief stop watching the channel. The alarm state is left as it is
+/////////////////////////////////////////////////////////////////////////
+void ADC_Watchdog_Stop(void)
+{
+	uint32_t WasConverting = ADC1->CR & ADC_CR_ADSTART;
+
+	ADC1->IER &= ~ADC_IER_AWDIE;
+
+	StopConversion();
+
+	ADC1->CFGR1 &= ~ADC_CFGR1_AWDEN;
+
+	if ( ScanChannelCount )
+	{
+		RestartScan(WasConverting);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief copy the alarm state
+///
+///	\param destination where to copy it
+///
+///	\return TRUE success. ERROR_INVALID_POINTER = Invalid destination pointer
+/////////////////////////////////////////////////////////////////////////
+int_fast8_t ADC_Watchdog_GetAlarm(ADCAlarmType *destination)
+{
+	uint32_t ChangeCount;
+
+	if ( !destination )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	// copy again if the interrupt changed it while we were copying
+	do
+	{
+		ChangeCount = AlarmChangeCount;
+		MEMORY_BARRIER();
+
+		destination->State = AlarmState;
+		destination->TimestampMs = AlarmTimestampMs;
+
+		MEMORY_BARRIER();
+	} while ( ChangeCount != AlarmChangeCount );
+
+	destination->ChangeCount = ChangeCount;
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the ADC interrupt handler
 /////////////////////////////////////////////////////////////////////////
-float ADC_ReturnCalibratedTemperature(uint_fast16_t rawData)
+void ADC1_IRQHandler(void)
 {
-	int32_t Temperature; /* will contain the temperature in degree Fahrenheit */
-	Temperature = (((int32_t) rawData * VDD_APPLI / VDD_CALIB) - (int32_t) *TEMP30_CAL_ADDR );
-	Temperature = Temperature * (int32_t)(110 - 30);
-	Temperature = Temperature / (int32_t)(*TEMP110_CAL_ADDR - *TEMP30_CAL_ADDR);
-	Temperature = Temperature + 30;
+	if ( (ADC1->IER & ADC_IER_EOCIE) && (ADC1->ISR & ADC_ISR_EOC) )
+	{
+		// reading the data clears EOC
+		ConversionSamples[ConversionCount++] = (uint16_t)ADC1->DR;
+
+		if ( (ADC1->ISR & ADC_ISR_EOSEQ) || ConversionCount >= ADC_MAX_CONVERSION_CHANNELS )
+		{
+			ADC1->ISR = ADC_ISR_EOSEQ;
+			ADC1->IER &= ~ADC_IER_EOCIE;
+
+			// publish the samples before the done state
+			MEMORY_BARRIER();
+			ConversionState = ADCConversion_Done;
+
+			if ( ConversionHandler )
+			{
+				ConversionHandler(&ConversionSamples[0], ConversionCount);
+			}
+
+			Event_Post(Event_Conversion);
+		}
+	}
 
-	return ((float)(Temperature - 32.0) * ((float)(5.0/9.0)));
+	if ( (ADC1->IER & ADC_IER_AWDIE) && (ADC1->ISR & ADC_ISR_AWD) )
+	{
+		ADC1->ISR = ADC_ISR_AWD;
+
+		// the DMA or the conversion above has already taken the data
+		// register, so take the sample from where it went
+		if ( ScanChannelCount )
+		{
+			WatchdogEvent(ReturnWatchedScanSample());
+		}
+		else if ( ConversionCount )
+		{
+			WatchdogEvent(ConversionSamples[ConversionCount - 1]);
+		}
+		Event_Post(Event_Conversion);
+	}
+
+	if ( (ADC1->IER & ADC_IER_OVRIE) && (ADC1->ISR & ADC_ISR_OVR) )
+	{
+		// a sample was lost so the channels no longer line up with the
+		// vectors. Start again from the first channel
+		ScanOverrunCount++;
+		StopConversion();
+		RestartScan(FALSE);
+	}
 }
@@ -0,0 +1,64 @@
+/////////////////////////////////////////////////////////////////////////
+///	\file crc.c
+///	\brief this is the CRC unit hardware interface layer.
+///
+///	The unit is set up to give the standard CRC-32 (the one used by zip and
+///	ethernet) so the host can check our frames with any library.
+///
+///	Author: Ronald Sousa (@Opticalworm)
+/////////////////////////////////////////////////////////////////////////
+#include "MCU/crc.h"
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief the standard CRC-32 inverts the result
+/////////////////////////////////////////////////////////////////////////
+#define CRC32_FINAL_XOR 0xFFFFFFFF
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	Enable the CRC unit clock
+/////////////////////////////////////////////////////////////////////////
+void CRC32_Init(void)
+{
+	RCC->AHBENR |= RCC_AHBENR_CRCEN;
+
+	CRC->INIT = 0xFFFFFFFF;
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	Calculate the CRC-32 of an array
+///
+///	\param source the data
+///	\param length number of bytes
+///
+///	\return the CRC-32
+///
+///	\note the unit is shared. Only call this from the main loop
+/////////////////////////////////////////////////////////////////////////
+uint32_t CRC32_Calculate(const uint8_t *source, uint32_t length)
+{
+	// reflect each input byte and the output, then start from INIT
+	CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT | CRC_CR_RESET;
+
+	// the M0 can't read unaligned words
+	while ( length && ((uint32_t)source & 0x3) )
+	{
+		*(__IO uint8_t *)&CRC->DR = *source++;
+		length--;
+	}
+
+	// the unit takes the top byte of a word first so swap it to keep the
+	// bytes in memory order
+	while ( length >= 4 )
+	{
+		CRC->DR = __REV(*(const uint32_t *)source);
+		source += 4;
+		length -= 4;
+	}
+
+	while ( length-- )
+	{
+		*(__IO uint8_t *)&CRC->DR = *source++;
+	}
+
+	return CRC->DR ^ CRC32_FINAL_XOR;
+}
@@ -0,0 +1,189 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file event.c
+///
+///	\brief Run to completion event dispatch
+///
+///	The interrupts post events and the main loop runs the handler of the
+///	highest priority event pending, one at a time. Each handler runs to
+///	completion, so a higher priority event waits for at most the longest
+///	handler.
+///
+///	An event is a byte flag. A single byte store can't be torn, so any
+///	interrupt at any priority can post without disabling the interrupts.
+///	The M0 has no exclusive access instructions for a lock-free queue of
+///	several producers. The data that goes with an event is already in the
+///	producer's own queue, so the flag only says where to look. Events
+///	posted again before they are handled count once.
+///
+///	Interrupt work that is too long to do at interrupt priority is
+///	deferred to PendSV, which runs at the lowest priority once the other
+///	interrupts are done.
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+#include "MCU/event.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the events waiting for the main loop
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint8_t Pending[EVENT_NUMBER_OF_EVENTS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the event handlers. 0 = the event is dropped
+///////////////////////////////////////////////////////////////////////////////
+static EventHandlerType Handler[EVENT_NUMBER_OF_EVENTS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the work waiting for PendSV
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint8_t DeferredPending[EVENT_NUMBER_OF_DEFERRED];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the deferred work handlers. Run at PendSV priority
+///////////////////////////////////////////////////////////////////////////////
+static volatile EventHandlerType DeferredHandler[EVENT_NUMBER_OF_DEFERRED];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief set PendSV to the lowest priority. Call once at start up
+///////////////////////////////////////////////////////////////////////////////
+void Event_Init(void)
+{
+	NVIC_SetPriority(PendSV_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief set the function the main loop calls for an event
+///
+///	\param event the event
+///	\param handler the event handler. 0 = drop the event
+///////////////////////////////////////////////////////////////////////////////
+void Event_SetHandler(EventType event, EventHandlerType handler)
+{
+	if ( (uint32_t)event < EVENT_NUMBER_OF_EVENTS )
+	{
+		Handler[event] = handler;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief post an event to the main loop. Safe from any context
+///
+///	\param event the event
+///////////////////////////////////////////////////////////////////////////////
+void Event_Post(EventType event)
+{
+	if ( (uint32_t)event < EVENT_NUMBER_OF_EVENTS )
+	{
+		// the data that goes with the event must be seen before the event
+		MEMORY_BARRIER();
+		Pending[event] = TRUE;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return TRUE if any event is waiting. Call with the interrupts
+/// disabled before sleeping, so an event posted after the check still
+/// wakes the core
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t Event_IsPending(void)
+{
+	uint32_t Index;
+
+	for ( Index = 0; Index < EVENT_NUMBER_OF_EVENTS; Index++ )
+	{
+		if ( Pending[Index] )
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief run the handler of the highest priority event waiting. The event
+/// is cleared before its handler runs, so one posted during the handler
+/// runs it again.
+///
+///	\return TRUE an event was handled. FALSE none waiting
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t Event_Dispatch(void)
+{
+	uint32_t Index;
+
+	for ( Index = 0; Index < EVENT_NUMBER_OF_EVENTS; Index++ )
+	{
+		if ( Pending[Index] )
+		{
+			Pending[Index] = FALSE;
+
+			// don't read the event data before the event was cleared
+			MEMORY_BARRIER();
+
+			if ( Handler[Index] )
+			{
+				Handler[Index]();
+			}
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief set the function PendSV calls for deferred work
+///
+///	\param work the deferred work
+///	\param handler the work handler
+///////////////////////////////////////////////////////////////////////////////
+void Event_SetDeferredHandler(EventDeferredType work, EventHandlerType handler)
+{
+	if ( (uint32_t)work < EVENT_NUMBER_OF_DEFERRED )
+	{
+		DeferredHandler[work] = handler;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief defer work from an interrupt to PendSV. It runs once no other
+/// interrupt is active
+///
+///	\param work the deferred work
+///////////////////////////////////////////////////////////////////////////////
+void Event_Defer(EventDeferredType work)
+{
+	if ( (uint32_t)work < EVENT_NUMBER_OF_DEFERRED )
+	{
+		MEMORY_BARRIER();
+		DeferredPending[work] = TRUE;
+		SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the PendSV interrupt handler. Runs the deferred work, highest
+/// priority first
+///////////////////////////////////////////////////////////////////////////////
+void PendSV_Handler(void)
+{
+	EventHandlerType Work;
+	uint32_t Index;
+
+	for ( Index = 0; Index < EVENT_NUMBER_OF_DEFERRED; Index++ )
+	{
+		if ( DeferredPending[Index] )
+		{
+			DeferredPending[Index] = FALSE;
+			MEMORY_BARRIER();
+
+			Work = DeferredHandler[Index];
+
+			if ( Work )
+			{
+				Work();
+			}
+		}
+	}
+}
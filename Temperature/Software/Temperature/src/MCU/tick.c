@@ -5,6 +5,7 @@
 /// Author: Ronald Sousa (Opticalworm)
 /////////////////////////////////////////////////////////////////////////
 #include "MCU/tick.h"
+#include "MCU/event.h"
 
 /////////////////////////////////////////////////////////////////////////
 /// \brief defines the frequency we want the system tick to trigger.
@@ -18,13 +19,38 @@
 /////////////////////////////////////////////////////////////////////////
 static volatile uint32_t TickCounter;
 
+/////////////////////////////////////////////////////////////////////////
+/// \brief the number of times TickCounter has overflowed. The top half
+/// of the 64 bit tick
+/////////////////////////////////////////////////////////////////////////
+static volatile uint32_t TickHigh;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief SysTick counts in one tick
+/////////////////////////////////////////////////////////////////////////
+static uint32_t CountsPerTick;
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the most ticks SysTick's 24 bit counter can sleep through
+/////////////////////////////////////////////////////////////////////////
+static uint32_t MaxSleepMs;
+
 /////////////////////////////////////////////////////////////////////////
 /// \brief setup the ARM M0 tick counter to trigger every 1ms
 /////////////////////////////////////////////////////////////////////////
 void Tick_init(void)
 {
+    CountsPerTick = SystemCoreClock / TIMER_FREQUENCY_HZ;
+    MaxSleepMs = SysTick_LOAD_RELOAD_Msk / CountsPerTick;
+
     // configure the system tick so that it trigger every one ms
-  SysTick_Config(SystemCoreClock / TIMER_FREQUENCY_HZ);
+  SysTick_Config(CountsPerTick);
+
+    // priority 0, the same as ADC1 and DMA1_Channel1 and above the
+    // rest. Interrupts of equal priority don't preempt each other, so no
+    // interrupt that reads the time can see TickCounter and TickHigh half
+    // updated. The lock free reads in Tick_GetUs rely on that
+    NVIC_SetPriority(SysTick_IRQn, 0);
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -40,6 +66,46 @@ uint32_t Tick_GetMs(void)
     return TickCounter;
 }
 
+/////////////////////////////////////////////////////////////////////////
+/// \brief return the number of micro-seconds since power up. 64 bits, so
+/// it never overflows. Safe to call from any context without disabling
+/// the interrupts.
+///
+/// The tick is read again if the SysTick interrupt ran while it was being
+/// read. Nothing can interrupt the SysTick interrupt, so an interrupt
+/// reading the clock never sees the tick half updated. When SysTick has
+/// wrapped but its interrupt hasn't run yet, because it is masked or the
+/// caller is an interrupt of the same priority, the pending tick is
+/// counted here.
+///
+/// \return number of micro-seconds.
+/////////////////////////////////////////////////////////////////////////
+uint64_t Tick_GetUs(void)
+{
+    uint32_t High;
+    uint32_t Ms;
+    uint32_t Count;
+    uint64_t Ticks;
+
+    do
+    {
+        High = TickHigh;
+        Ms = TickCounter;
+        Count = SysTick->VAL;
+        Ticks = ((uint64_t)High << 32) | Ms;
+
+        if ( SCB->ICSR & SCB_ICSR_PENDSTSET_Msk )
+        {
+            // wrapped before or after the count was read. Read it again now
+            // that it certainly has
+            Count = SysTick->VAL;
+            Ticks++;
+        }
+    } while ( Ms != TickCounter || High != TickHigh );
+
+    return (Ticks * 1000) + (((CountsPerTick - 1 - Count) * 1000) / CountsPerTick);
+}
+
 /////////////////////////////////////////////////////////////////////////
 /// \brief this is a blocking delay.
 ///
@@ -143,13 +209,112 @@ int_fast8_t Tick_DelayMs_NonBlocking(uint_fast8_t reset, TickType * config)
 
 }
 
+/////////////////////////////////////////////////////////////////////////
+/// \brief sleep until an interrupt or until idleMs ticks have passed.
+/// Call with the interrupts disabled, after checking there is no work.
+/// Any interrupt still wakes the core, and runs once they are enabled
+/// again, so one that comes after the check isn't missed.
+///
+/// For longer than a tick SysTick is reprogrammed to skip the idle
+/// ticks. On waking TickCounter is moved on by the ticks slept through
+/// and SysTick lines up again with the next tick boundary, so Tick_GetMs
+/// stays right. Only the few counts while SysTick is stopped are lost.
+///
+/// \param idleMs the most ticks to sleep. Up to MaxSleepMs
+/////////////////////////////////////////////////////////////////////////
+void Tick_Sleep(uint32_t idleMs)
+{
+    uint32_t Reload;
+    uint32_t Elapsed;
+    uint32_t CompleteTicks;
+    uint32_t OldTickCounter;
+
+    if ( idleMs > MaxSleepMs )
+    {
+        idleMs = MaxSleepMs;
+    }
+
+    if ( idleMs < 2 )
+    {
+        // the next tick wakes us
+        __WFI();
+        return;
+    }
+
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+
+    if ( SCB->ICSR & SCB_ICSR_PENDSTSET_Msk )
+    {
+        // a tick is due. Let it be counted
+        SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+        return;
+    }
+
+    // the rest of this tick and then idleMs - 1 whole ones
+    Reload = SysTick->VAL + (CountsPerTick * (idleMs - 1));
+
+    SysTick->LOAD = Reload;
+    SysTick->VAL = 0;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+
+    __WFI();
+
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+
+    if ( SCB->ICSR & SCB_ICSR_PENDSTSET_Msk )
+    {
+        // slept the whole time. The pending interrupt counts the last tick
+        CompleteTicks = idleMs - 1;
+
+        Elapsed = Reload - SysTick->VAL;
+        Reload = (Elapsed < CountsPerTick) ? (CountsPerTick - Elapsed) : 1;
+    }
+    else
+    {
+        // woken early. Counted from the start of the tick we went to sleep in
+        Elapsed = (CountsPerTick * idleMs) - SysTick->VAL;
+        CompleteTicks = Elapsed / CountsPerTick;
+        Reload = ((CompleteTicks + 1) * CountsPerTick) - Elapsed;
+    }
+
+    if ( Reload < 2 )
+    {
+        // on the boundary. Count it and run a whole tick
+        CompleteTicks++;
+        Reload = CountsPerTick;
+    }
+
+    // run to the next tick boundary, so the counter always stays within
+    // CountsPerTick - 1 for Tick_GetUs. The counter takes LOAD straight
+    // away, so the normal reload can be put back once it has started
+    SysTick->LOAD = Reload - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    SysTick->LOAD = CountsPerTick - 1;
+
+    OldTickCounter = TickCounter;
+    TickCounter = OldTickCounter + CompleteTicks;
+
+    if ( TickCounter < OldTickCounter )
+    {
+        TickHigh++;
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////
 /// \brief ARM M0 hardware interrupt. This should trigger every
-/// 1 ms and update TickCounter.
+/// 1 ms, update TickCounter and post Event_Tick.
 ///
 /// \sa TickCounter
 /////////////////////////////////////////////////////////////////////////
 void SysTick_Handler(void)
 {
     TickCounter++;
+
+    if ( !TickCounter )
+    {
+        TickHigh++;
+    }
+
+    Event_Post(Event_Tick);
 }
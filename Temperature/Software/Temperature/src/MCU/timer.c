@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file timer.c
+///
+///	\brief Software timers on a hashed timer wheel
+///
+///	The wheel has one slot per ms, TIMER_WHEEL_SIZE of them, and a timer
+///	sits in the slot of its expiry tick. Timers further away than a turn
+///	of the wheel share the slot and are passed over until their turn comes.
+///	Starting and cancelling a timer are O(1) and a tick with nothing due
+///	costs one look at an empty slot.
+///
+///	The wheel is turned by SysTick_Handler counting the ms. Timer_Process
+///	catches up with it from the main loop and calls the expired timers'
+///	callbacks there, so they can do anything the main loop does. Timers
+///	must only be started and cancelled from the main loop.
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+#include "MCU/timer.h"
+#include "MCU/tick.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the slots of the wheel. Each is a list of timers
+///////////////////////////////////////////////////////////////////////////////
+static TimerType *Wheel[TIMER_WHEEL_SIZE];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the last tick processed. The tick starts at 0 on power up, so
+/// this does too
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t WheelMs;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief put a timer in the list
+///
+///	\param list the list
+///	\param timer the timer
+///////////////////////////////////////////////////////////////////////////////
+static void LinkTimer(TimerType **list, TimerType *timer)
+{
+	timer->Next = *list;
+
+	if ( timer->Next )
+	{
+		timer->Next->Link = &timer->Next;
+	}
+
+	timer->Link = list;
+	*list = timer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief take a timer out of the list it is in
+///
+///	\param timer the timer
+///////////////////////////////////////////////////////////////////////////////
+static void UnlinkTimer(TimerType *timer)
+{
+	*timer->Link = timer->Next;
+
+	if ( timer->Next )
+	{
+		timer->Next->Link = timer->Link;
+	}
+
+	timer->Link = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief start a timer. A running timer is started again.
+///
+///	\param timer the timer
+///	\param delayMs ms until the first expiry. At least 1
+///	\param periodMs ms between the following expiries. 0 = one shot
+///	\param callback called in the main loop on each expiry
+///	\param context passed to the callback
+///////////////////////////////////////////////////////////////////////////////
+void Timer_Start(TimerType *timer, uint32_t delayMs, uint32_t periodMs, TimerCallbackType callback, void *context)
+{
+	if ( !timer || !callback )
+	{
+		return;
+	}
+
+	Timer_Cancel(timer);
+
+	if ( !delayMs )
+	{
+		// the slot of this tick may have been processed already
+		delayMs = 1;
+	}
+
+	timer->ExpiryMs = Tick_GetMs() + delayMs;
+	timer->PeriodMs = periodMs;
+	timer->Callback = callback;
+	timer->Context = context;
+
+	LinkTimer(&Wheel[timer->ExpiryMs & (TIMER_WHEEL_SIZE - 1)], timer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief stop a timer. Does nothing if it isn't running
+///
+///	\param timer the timer
+///////////////////////////////////////////////////////////////////////////////
+void Timer_Cancel(TimerType *timer)
+{
+	if ( timer && timer->Link )
+	{
+		UnlinkTimer(timer);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return TRUE if the timer is running
+///
+///	\param timer the timer
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t Timer_IsRunning(const TimerType *timer)
+{
+	return (timer && timer->Link) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief turn the wheel up to the tick and call the callbacks of the
+/// timers that expired. Call from the main loop.
+///
+/// The expired timers are moved to a list of their own before any callback
+/// is called, so a callback can start and cancel any timer. A periodic
+/// timer is reloaded before its callback. If it fell more than a period
+/// behind, it skips the expiries it missed rather than catching up with a
+/// burst.
+///////////////////////////////////////////////////////////////////////////////
+void Timer_Process(void)
+{
+	TimerType *Expired = 0;
+	TimerType *Timer;
+	TimerType *Next;
+	uint32_t Now = Tick_GetMs();
+
+	if ( Now == WheelMs )
+	{
+		return;
+	}
+
+	if ( (Now - WheelMs) > TIMER_WHEEL_SIZE )
+	{
+		// behind by more than a turn. One turn visits every slot
+		WheelMs = Now - TIMER_WHEEL_SIZE;
+	}
+
+	while ( WheelMs != Now )
+	{
+		WheelMs++;
+
+		for ( Timer = Wheel[WheelMs & (TIMER_WHEEL_SIZE - 1)]; Timer; Timer = Next )
+		{
+			Next = Timer->Next;
+
+			if ( (int32_t)(Now - Timer->ExpiryMs) >= 0 )
+			{
+				UnlinkTimer(Timer);
+				LinkTimer(&Expired, Timer);
+			}
+		}
+	}
+
+	while ( Expired )
+	{
+		Timer = Expired;
+		UnlinkTimer(Timer);
+
+		if ( Timer->PeriodMs )
+		{
+			Timer->ExpiryMs += Timer->PeriodMs;
+
+			if ( (int32_t)(Now - Timer->ExpiryMs) >= 0 )
+			{
+				Timer->ExpiryMs = Now + Timer->PeriodMs;
+			}
+
+			LinkTimer(&Wheel[Timer->ExpiryMs & (TIMER_WHEEL_SIZE - 1)], Timer);
+		}
+
+		Timer->Callback(Timer->Context);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return how long the core can sleep before a timer expires. Looks
+/// at every running timer, so only call it when about to sleep.
+///
+///	\return ms to the next expiry. 0 = Timer_Process has work.
+///	TICK_IDLE_FOREVER = no timer running
+///////////////////////////////////////////////////////////////////////////////
+uint32_t Timer_GetIdleMs(void)
+{
+	const TimerType *Timer;
+	uint32_t Now = Tick_GetMs();
+	uint32_t IdleMs = TICK_IDLE_FOREVER;
+	uint32_t Slot;
+
+	if ( Now != WheelMs )
+	{
+		return 0;
+	}
+
+	for ( Slot = 0; Slot < TIMER_WHEEL_SIZE; Slot++ )
+	{
+		for ( Timer = Wheel[Slot]; Timer; Timer = Timer->Next )
+		{
+			if ( (int32_t)(Timer->ExpiryMs - Now) <= 0 )
+			{
+				return 0;
+			}
+
+			if ( (Timer->ExpiryMs - Now) < IdleMs )
+			{
+				IdleMs = Timer->ExpiryMs - Now;
+			}
+		}
+	}
+
+	return IdleMs;
+}
@@ -5,8 +5,10 @@
 ///
 ///	Author: Ronald Sousa (Opticalworm)
 /////////////////////////////////////////////////////////////////////////
+#include <string.h>
 #include "MCU/usart2.h"
 #include "FIFO.h"
+#include "MCU/event.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief alternative function set bit 1 for AFR2
@@ -19,10 +21,114 @@
 #define GPIO_AFRL_AFR3_0 ((uint32_t) 0x00001000)
 
 /////////////////////////////////////////////////////////////////////////
-/// \brief enable 16x oversampling. Used to reduce the baudrate calculation
-/// error.
+/// \brief the smallest clock divider with 16x oversampling. Below this the
+/// USART switches to 8x oversampling.
 /////////////////////////////////////////////////////////////////////////
-//#define USART_OVER_SAMPLE_16
+#define USART_MIN_DIVIDER_OVER_SAMPLE_16 16
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the smallest clock divider with 8x oversampling. Sets the
+/// fastest baudrate, SystemCoreClock / 8.
+/////////////////////////////////////////////////////////////////////////
+#define USART_MIN_DIVIDER_OVER_SAMPLE_8 8
+
+/////////////////////////////////////////////////////////////////////////
+/// \brief the largest clock divider BRR can hold. Sets the slowest baudrate.
+/////////////////////////////////////////////////////////////////////////
+#define USART_MAX_DIVIDER 0xFFFF
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief defines the receive fifo size. Must be a power of two. 89ms of
+/// data at 115200 baud
+///////////////////////////////////////////////////////////////////////////////
+#define RECEIVE_BUFFER_SIZE 1024
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the receive fifo storage. The receive DMA writes into it in
+/// circular mode.
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t ReceiveBuffer[RECEIVE_BUFFER_SIZE];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the receive fifo. The DMA fills the buffer and the IDLE and DMA
+/// half/full interrupts move the write position. Read by GetByte.
+///////////////////////////////////////////////////////////////////////////////
+static FIFO_Type ReceiveFifo;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief USART2 RX is hard wired to DMA channel 5
+///////////////////////////////////////////////////////////////////////////////
+#define RECEIVE_DMA_CHANNEL DMA1_Channel5
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of times the DMA overwrote data that wasn't read in time
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t ReceiveOverflowCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief defines the transmit fifo size. Must be a power of two
+///////////////////////////////////////////////////////////////////////////////
+#define TRANSMIT_BUFFER_SIZE 512
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the transmit fifo storage
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t TransmitBuffer[TRANSMIT_BUFFER_SIZE];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the transmit fifo. Written by the send functions and read by the
+/// transmit DMA
+///////////////////////////////////////////////////////////////////////////////
+static FIFO_Type TransmitFifo;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief defines the number of transmit descriptors. Must be a power of two
+///////////////////////////////////////////////////////////////////////////////
+#define TRANSMIT_DESCRIPTOR_COUNT 16
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the largest number of bytes a single DMA transfer can move
+///////////////////////////////////////////////////////////////////////////////
+#define DMA_MAX_TRANSFER_LENGTH 0xFFFF
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief USART2 TX is hard wired to DMA channel 4
+///////////////////////////////////////////////////////////////////////////////
+#define TRANSMIT_DMA_CHANNEL DMA1_Channel4
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief defines a block of data waiting to be sent by the DMA
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	const uint8_t		*Source;	///< data sent in place (flash or RAM). 0 = the data is in the transmit fifo
+	volatile uint32_t	Length;		///< in place data size. For fifo data it's the fifo write position the block ends at
+} TransmitDescriptorType;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the transmit descriptor queue. The send functions add to it and
+/// the DMA transfer complete interrupt chains through it.
+///////////////////////////////////////////////////////////////////////////////
+static TransmitDescriptorType TransmitDescriptor[TRANSMIT_DESCRIPTOR_COUNT];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running descriptor write position. Only moved by the send functions
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t DescriptorWritePosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief free running descriptor read position. Only moved by StartNextTransfer
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t DescriptorReadPosition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of bytes already sent from the current in place descriptor
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t DescriptorOffset;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief size of the DMA transfer in progress. 0 = the DMA is idle
+///////////////////////////////////////////////////////////////////////////////
+static volatile uint32_t ActiveTransferLength;
 
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Keeps track if the serial port is configure and open
@@ -50,19 +156,81 @@ static void Close(void)
 	NVIC_DisableIRQ(USART2_IRQn);
 }
 
+/////////////////////////////////////////////////////////////////////////
+///	\brief	return the USART clock divider closest to the desired baudrate.
+///
+///	With 16x oversampling BRR is the divider. With 8x oversampling BRR holds
+///	twice the divider, with bits 3:0 shifted right by one, which gives the
+///	same whole number steps. The achieved baudrate is SystemCoreClock / divider
+///	in both modes.
+///
+///	\param baud the desire baudrate
+///
+///	\return the divider. 0 = baudrate can't be reached
+/////////////////////////////////////////////////////////////////////////
+static uint32_t CalculateDivider(const uint32_t baud)
+{
+	uint32_t Divider;
+
+	if ( !baud )
+	{
+		return 0;
+	}
+
+	// round to the nearest divider rather than truncate
+	Divider = (SystemCoreClock + (baud / 2)) / baud;
+
+	if ( Divider < USART_MIN_DIVIDER_OVER_SAMPLE_8 || Divider > USART_MAX_DIVIDER )
+	{
+		return 0;
+	}
+
+	return Divider;
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	return the baudrate the USART would really run at for the
+///	desired baudrate. Doesn't change the port settings.
+///
+///	\param baud the desire baudrate
+///
+///	\return the achieved baudrate. 0 = baudrate can't be reached
+/////////////////////////////////////////////////////////////////////////
+static uint32_t GetActualBaudrate(const uint32_t baud)
+{
+	uint32_t Divider = CalculateDivider(baud);
+
+	if ( !Divider )
+	{
+		return 0;
+	}
+
+	return SystemCoreClock / Divider;
+}
+
 /////////////////////////////////////////////////////////////////////////
 ///	\brief	Set usart baudrate. can be called at any time.
 ///
 ///	\param baud the desire baudrate
 ///
+///	\return TRUE = success. FALSE = baudrate can't be reached. The current
+///	setting is left unchanged.
+///
 ///	\note setting baudrate will effect any data currently been sent.susb
 ///		make sure that you check that the write buffer is empty
+///	\sa GetActualBaudrate IsTransmitBusy
 /////////////////////////////////////////////////////////////////////////
-static void Setbaudrate(const uint32_t baud)
+static uint_fast8_t Setbaudrate(const uint32_t baud)
 {
 	uint_fast8_t WasUartEnable = FALSE;
+	uint32_t Divider;
 
-	uint16_t BaudrateTemp = 0;
+	Divider = CalculateDivider(baud);
+
+	if ( !Divider )
+	{
+		return FALSE;
+	}
 
 	if (IsOpenFlag)
 	{
@@ -70,15 +238,18 @@ static void Setbaudrate(const uint32_t baud)
 		Close();
 	}
 
-#ifdef USART_OVER_SAMPLE_16
-	BaudrateTemp = (SystemCoreClock) / (baud);
-#else
-	BaudrateTemp = (2 * SystemCoreClock) / (baud);
-	BaudrateTemp = ((BaudrateTemp & 0xFFFFFFF0) | ((BaudrateTemp >> 1) & 0x00000007));
-#endif
-
-	USART2->BRR = BaudrateTemp;
-
+	// OVER8 can only be changed while the USART is disabled
+	if ( Divider >= USART_MIN_DIVIDER_OVER_SAMPLE_16 )
+	{
+		USART2->CR1 &= ~USART_CR1_OVER8;
+		USART2->BRR = Divider;
+	}
+	else
+	{
+		USART2->CR1 |= USART_CR1_OVER8;
+		Divider <<= 1;
+		USART2->BRR = (Divider & 0xFFF0) | ((Divider & 0x000F) >> 1);
+	}
 
 	if(WasUartEnable)
 	{
@@ -86,21 +257,250 @@ static void Setbaudrate(const uint32_t baud)
 		USART2->CR1 |=  USART_CR1_UE;
 	}
 
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	you can use this function to check if all the queued data
+///	has been sent
+///
+///	\return TRUE = Busy else all data has left the port
+/////////////////////////////////////////////////////////////////////////
+static uint_fast8_t IsTransmitBusy(void)
+{
+	if ( (DescriptorWritePosition == DescriptorReadPosition) && !ActiveTransferLength && (USART2->ISR & USART_ISR_TC) )
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	return the number of bytes that can be queued for transmit.
+///	the send functions reject any data that doesn't fit.
+///
+///	\return free space in the transmit fifo. 0 = port is not open or no
+///	descriptor is free
+/////////////////////////////////////////////////////////////////////////
+static uint32_t GetTransmitFreeSpace(void)
+{
+	if ( IsOpenFlag && (DescriptorWritePosition - DescriptorReadPosition) < TRANSMIT_DESCRIPTOR_COUNT )
+	{
+		return FIFO_FreeSpace(&TransmitFifo);
+	}
+
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	return the number of transmit descriptors free. Each send
+///	takes at most one, so a caller that must queue several sends together
+///	can check they all fit first.
+///
+///	\return free descriptors. 0 = port is not open or none free
+/////////////////////////////////////////////////////////////////////////
+static uint32_t GetTransmitFreeDescriptors(void)
+{
+	if ( IsOpenFlag )
+	{
+		return TRANSMIT_DESCRIPTOR_COUNT - (DescriptorWritePosition - DescriptorReadPosition);
+	}
+
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	start the DMA on a block of data
+///
+///	\param source the data to send
+///	\param length the number of bytes. range 1 to DMA_MAX_TRANSFER_LENGTH
+/////////////////////////////////////////////////////////////////////////
+static void StartTransfer(const uint8_t *source, uint32_t length)
+{
+	ActiveTransferLength = length;
+
+	TRANSMIT_DMA_CHANNEL->CCR &= ~DMA_CCR_EN; // the channel must be off while it's configured
+	TRANSMIT_DMA_CHANNEL->CMAR = (uint32_t)source;
+	TRANSMIT_DMA_CHANNEL->CNDTR = length;
+	TRANSMIT_DMA_CHANNEL->CCR |= DMA_CCR_EN;
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	start the DMA on the next pending block and retire the
+///	descriptors that are done.
+///
+///	\note only called by the transfer complete interrupt or by the main
+///	loop while the DMA is idle, so the two never run at the same time.
+/////////////////////////////////////////////////////////////////////////
+static void StartNextTransfer(void)
+{
+	TransmitDescriptorType *Descriptor;
+	uint8_t *FifoSource;
+	uint32_t Remaining;
+	uint32_t Length;
+
+	while ( DescriptorReadPosition != DescriptorWritePosition )
+	{
+		Descriptor = &TransmitDescriptor[DescriptorReadPosition & (TRANSMIT_DESCRIPTOR_COUNT - 1)];
+
+		if ( Descriptor->Source )
+		{
+			Remaining = Descriptor->Length - DescriptorOffset;
+
+			if ( Remaining )
+			{
+				StartTransfer(Descriptor->Source + DescriptorOffset, (Remaining > DMA_MAX_TRANSFER_LENGTH) ? DMA_MAX_TRANSFER_LENGTH : Remaining);
+				return;
+			}
+		}
+		else
+		{
+			// the fifo data of this descriptor ends at the recorded write position
+			Remaining = Descriptor->Length - TransmitFifo.ReadPosition;
+
+			if ( Remaining )
+			{
+				// the fifo may wrap, in which case the rest goes in the next transfer
+				Length = FIFO_PeekRead(&TransmitFifo, &FifoSource);
+
+				if ( Length > Remaining )
+				{
+					Length = Remaining;
+				}
+
+				StartTransfer(FifoSource, Length);
+				return;
+			}
+		}
+
+		// this descriptor is done
+		DescriptorOffset = 0;
+		DescriptorReadPosition++;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	handles the end of a DMA transfer. Releases the sent data and
+///	chains the next block.
+/////////////////////////////////////////////////////////////////////////
+static inline void TransmitComplete(void)
+{
+	TransmitDescriptorType *Descriptor = &TransmitDescriptor[DescriptorReadPosition & (TRANSMIT_DESCRIPTOR_COUNT - 1)];
+
+	if ( Descriptor->Source )
+	{
+		DescriptorOffset += ActiveTransferLength;
+	}
+	else
+	{
+		FIFO_CommitRead(&TransmitFifo, ActiveTransferLength);
+	}
+
+	ActiveTransferLength = 0;
+
+	StartNextTransfer();
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	add a descriptor to the queue
+///
+///	\param source in place data or 0 for fifo data
+///	\param length see TransmitDescriptorType
+///
+///	\return TRUE = queued. FALSE = the descriptor queue is full
+/////////////////////////////////////////////////////////////////////////
+static uint_fast8_t PushDescriptor(const uint8_t *source, uint32_t length)
+{
+	TransmitDescriptorType *Descriptor;
+
+	if ( (DescriptorWritePosition - DescriptorReadPosition) >= TRANSMIT_DESCRIPTOR_COUNT )
+	{
+		return FALSE;
+	}
+
+	Descriptor = &TransmitDescriptor[DescriptorWritePosition & (TRANSMIT_DESCRIPTOR_COUNT - 1)];
+	Descriptor->Source = source;
+	Descriptor->Length = length;
+
+	// publish the descriptor before moving the write position
+	MEMORY_BARRIER();
+
+	DescriptorWritePosition++;
+
+	return TRUE;
 }
 
 /////////////////////////////////////////////////////////////////////////
-///	\brief	you can use this function to check if the write buffer is
-///	empty and ready for new data
+///	\brief	try to grow the last queued fifo descriptor so that small
+///	writes are sent by one DMA transfer.
+///
+///	\param fifoEnd the new fifo write position the descriptor ends at
 ///
-///	\return TRUE = Busy else ready. else false
+///	\return TRUE = extended. FALSE = a new descriptor is needed
 /////////////////////////////////////////////////////////////////////////
-static uint_fast8_t IsWriteBusy(void)
+static uint_fast8_t ExtendFifoDescriptor(uint32_t fifoEnd)
 {
-	if ( USART2->ISR & USART_ISR_TXE )
+	TransmitDescriptorType *Descriptor;
+
+	if ( DescriptorWritePosition == DescriptorReadPosition )
+	{
+		return FALSE;
+	}
+
+	Descriptor = &TransmitDescriptor[(DescriptorWritePosition - 1) & (TRANSMIT_DESCRIPTOR_COUNT - 1)];
+
+	if ( Descriptor->Source )
 	{
 		return FALSE;
 	}
 
+	Descriptor->Length = fifoEnd;
+
+	MEMORY_BARRIER();
+
+	// the DMA interrupt may have retired the descriptor just before we moved
+	// its end. If it's still queued the interrupt will see the new end.
+	return ( DescriptorWritePosition != DescriptorReadPosition );
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	start the DMA if it's idle
+/////////////////////////////////////////////////////////////////////////
+static void KickTransmit(void)
+{
+	if ( !ActiveTransferLength )
+	{
+		StartNextTransfer();
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief	copy data into the transmit fifo and queue it for the DMA.
+///
+///	\param source the data to send
+///	\param length the number of bytes
+///
+///	\return TRUE = data is queued. FALSE = not enough space in the transmit fifo
+/////////////////////////////////////////////////////////////////////////
+static uint_fast8_t QueueTransmit(const uint8_t *source, uint32_t length)
+{
+	// all or nothing so that messages are never cut in half
+	if ( length > GetTransmitFreeSpace() )
+	{
+		return FALSE;
+	}
+
+	FIFO_WriteBlock(&TransmitFifo, source, length);
+
+	if ( !ExtendFifoDescriptor(TransmitFifo.WritePosition) )
+	{
+		// can't fail. GetTransmitFreeSpace checked there is a free descriptor
+		PushDescriptor(0, TransmitFifo.WritePosition);
+	}
+
+	KickTransmit();
+
 	return TRUE;
 }
 
@@ -117,7 +517,8 @@ static uint_fast8_t Open(const uint32_t baudrate)
 	if(!IsOpenFlag)
 	{
 		// reset the FIFO
-	    FIFO_Initialiser();
+	    FIFO_Initialiser(&ReceiveFifo, &ReceiveBuffer[0], RECEIVE_BUFFER_SIZE);
+	    FIFO_Initialiser(&TransmitFifo, &TransmitBuffer[0], TRANSMIT_BUFFER_SIZE);
 
 	    // make sure that the USART resets to default
 	    RCC->APB1RSTR |= RCC_APB1RSTR_USART2RST;
@@ -129,6 +530,29 @@ static uint_fast8_t Open(const uint32_t baudrate)
 
 		RCC->AHBENR |= RCC_AHBENR_GPIOAEN; // en GPIOA clock
 
+		RCC->AHBENR |= RCC_AHBENR_DMA1EN; // en DMA clock
+
+		// transmit DMA: memory to USART TDR, 8bit, interrupt on transfer complete
+		DescriptorWritePosition = 0;
+		DescriptorReadPosition = 0;
+		DescriptorOffset = 0;
+		ActiveTransferLength = 0;
+
+		TRANSMIT_DMA_CHANNEL->CCR = 0;
+		TRANSMIT_DMA_CHANNEL->CPAR = (uint32_t)&USART2->TDR;
+		TRANSMIT_DMA_CHANNEL->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE;
+
+		// receive DMA: USART RDR to the receive fifo buffer in circular mode,
+		// interrupt when each half of the buffer is filled
+		ReceiveOverflowCount = 0;
+
+		RECEIVE_DMA_CHANNEL->CCR = 0;
+		RECEIVE_DMA_CHANNEL->CPAR = (uint32_t)&USART2->RDR;
+		RECEIVE_DMA_CHANNEL->CMAR = (uint32_t)&ReceiveBuffer[0];
+		RECEIVE_DMA_CHANNEL->CNDTR = RECEIVE_BUFFER_SIZE;
+		RECEIVE_DMA_CHANNEL->CCR = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE;
+		RECEIVE_DMA_CHANNEL->CCR |= DMA_CCR_EN;
+
 		GPIOA->MODER &= (~(GPIO_MODER_MODER2) | ~(GPIO_MODER_MODER3)); // clear PA2 moder
 		GPIOA->MODER  |= GPIO_MODER_MODER2_1 | GPIO_MODER_MODER3_1; // Set PA2 to alter function
 
@@ -138,17 +562,24 @@ static uint_fast8_t Open(const uint32_t baudrate)
 		// set baudrate
 		Setbaudrate(baudrate);
 
-		NVIC_SetPriority(USART2_IRQn, 0); // set the USART to the highest interrupt priority
+		// The DMA does the byte work so the USART no longer needs the highest
+		// priority. Leave level 0 to the ADC.
+		NVIC_SetPriority(USART2_IRQn, 1);
 
 		NVIC_EnableIRQ(USART2_IRQn); 	// enable interrupt
 
-		// enable interrupt for framing, overrun and noise;
-		USART2->CR3 |= USART_CR3_EIE;
+		// same level as the USART so they never preempt each other. Both move
+		// the receive fifo write position.
+		NVIC_SetPriority(DMA1_Channel4_5_IRQn, 1);
+		NVIC_EnableIRQ(DMA1_Channel4_5_IRQn);
+
+		// enable interrupt for framing, overrun and noise and let the DMA handle both directions
+		USART2->CR3 |= USART_CR3_EIE | USART_CR3_DMAT | USART_CR3_DMAR;
 
-		// enable interrupt for PE and RX
-		USART2->CR1 |= USART_CR1_PEIE | USART_CR1_RXNEIE;
+		// enable interrupt for PE and for the receive line going idle
+		USART2->CR1 |= USART_CR1_PEIE | USART_CR1_IDLEIE;
 
-		USART2->CR1 |= USART_CR1_OVER8 | USART_CR1_UE | USART_CR1_TE | USART_CR1_RE;
+		USART2->CR1 |= USART_CR1_UE | USART_CR1_TE | USART_CR1_RE;
 
 
 
@@ -166,17 +597,13 @@ static uint_fast8_t Open(const uint32_t baudrate)
 ///
 ///	\param source the character to send via serial
 ///
-/// \return true = success else port is not open
+/// \return true = success else port is not open or the transmit fifo is full
 ///////////////////////////////////////////////////////////////////////////////
 static uint_fast8_t SendByte(const uint8_t source)
 {
 	if(IsOpenFlag)
 	{
-		while( IsWriteBusy() );
-
-		USART2->TDR = source;
-
-		return TRUE;
+		return QueueTransmit(&source, 1);
 	}
 
     return FALSE;
@@ -192,7 +619,7 @@ static int_fast8_t DoesReceiveBufferHaveData(void)
 {
 	if(IsOpenFlag)
 	{
-		if(FIFO_CounnterBufferCount())
+		if(FIFO_CounnterBufferCount(&ReceiveFifo))
 		{
 			return TRUE;
 		}
@@ -224,23 +651,81 @@ static int_fast8_t GetByte(uint8_t *destination)
 
 	if(IsOpenFlag)
 	{
-		Result = FIFO_Read(destination);
+		Result = FIFO_Read(&ReceiveFifo, destination);
 	}
 
 	return Result;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief read a block of bytes from the serial port.
+///
+/// \param destination pointer to copy the received bytes to.
+/// \param length max number of bytes to read
+///
+/// \return number of bytes read. 0 = no data, port is not open or invalid pointer
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t GetArray(uint8_t *destination, uint32_t length)
+{
+	if(IsOpenFlag)
+	{
+		return FIFO_ReadBlock(&ReceiveFifo, destination, length);
+	}
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return how many times the receive DMA overwrote data that wasn't
+/// read in time since the port was opened
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t GetReceiveOverflowCount(void)
+{
+	return ReceiveOverflowCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief publish the bytes the receive DMA has written since the last call.
+///
+/// \note only called from the USART and DMA interrupts, which share the same
+/// priority, so the fifo still has a single producer.
+///////////////////////////////////////////////////////////////////////////////
+static inline void ReceiveDmaUpdate(void)
+{
+	uint32_t DmaPosition;
+	uint32_t NewBytes;
+	uint32_t FreeSpace;
+
+	// CNDTR counts down from the buffer size and reloads when it wraps
+	DmaPosition = (RECEIVE_BUFFER_SIZE - RECEIVE_DMA_CHANNEL->CNDTR) & (RECEIVE_BUFFER_SIZE - 1);
+	NewBytes = (DmaPosition - ReceiveFifo.WritePosition) & (RECEIVE_BUFFER_SIZE - 1);
+
+	if ( NewBytes )
+	{
+		FreeSpace = FIFO_FreeSpace(&ReceiveFifo);
+
+		if ( NewBytes > FreeSpace )
+		{
+			// the DMA has overwritten data that wasn't read yet
+			ReceiveOverflowCount++;
+			NewBytes = FreeSpace;
+		}
+
+		FIFO_CommitWrite(&ReceiveFifo, NewBytes);
+		Event_Post(Event_Receive);
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief internal function for handling the RX interrupt routing
 ///////////////////////////////////////////////////////////////////////////////
 static inline void InterruptRead(void)
 {
-	uint8_t DummyRead;
-
-	if(USART2->ISR & USART_ISR_RXNE)
+	if(USART2->ISR & USART_ISR_IDLE)
 	{
-		DummyRead = USART2->RDR;
-		FIFO_Write(DummyRead);
+		// the host stopped sending. Pass on whatever the DMA has so far
+		USART2->ICR = USART_ICR_IDLECF;
+		ReceiveDmaUpdate();
 	}
 
 	if (USART2->ISR & USART_ISR_ORE)
@@ -269,22 +754,14 @@ static inline void InterruptRead(void)
 ///
 /// \param source pointer to the string to write. must end with null
 ///
-/// \return true = success else either the port is not open or the pointer
-/// to the array is invalid.
+/// \return true = success else either the port is not open, the pointer
+/// to the array is invalid or the string doesn't fit in the transmit fifo.
 ///////////////////////////////////////////////////////////////////////////////
 static uint_fast8_t SendString(const uint8_t *source)
 {
     if (IsOpenFlag && source)
     {
-        while(*source)
-        {
-            if (!SendByte(*source) )
-            {
-                return FALSE;
-            }
-            source++;
-        }
-        return TRUE;
+        return QueueTransmit(source, strlen((const char *)source));
     }
     return FALSE;
 }
@@ -295,36 +772,77 @@ static uint_fast8_t SendString(const uint8_t *source)
 /// \param source pointer to the array to transmit.
 /// \param length is the size of the array
 ///
-/// \return true = success else either the port is not open or the pointer
-/// to the array is invalid.
+/// \return true = success else either the port is not open, the pointer
+/// to the array is invalid or the array doesn't fit in the transmit fifo.
 ///////////////////////////////////////////////////////////////////////////////
 static uint_fast8_t SendArray(const uint8_t *source, uint32_t length)
 {
     if (IsOpenFlag && source)
     {
-        for ( ; length ; length--)
+        return QueueTransmit(source, length);
+    }
+    return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Send an array of bytes without copying it. The DMA reads straight
+/// from the source, so this is ideal for constant strings in flash.
+///
+/// \param source pointer to the array to transmit.
+/// \param length is the size of the array
+///
+/// \return true = success else either the port is not open, the pointer
+/// to the array is invalid or no transmit descriptor is free.
+///
+/// \note RAM buffers must not be changed until IsTransmitBusy returns false
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t SendArrayInPlace(const uint8_t *source, uint32_t length)
+{
+    if (IsOpenFlag && source)
+    {
+        if ( !length )
         {
-            if ( !SendByte(*source) )
-            {
-                return FALSE;
-            }
-            source++;
+            return TRUE;
+        }
+
+        if ( PushDescriptor(source, length) )
+        {
+            KickTransmit();
+            return TRUE;
         }
-        return TRUE;
     }
     return FALSE;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief the USART 2 interrupt handler.
-///
-///	\todo Need to implement the TX interrupt
 ///////////////////////////////////////////////////////////////////////////////
 void USART2_IRQHandler(void)
 {
 	InterruptRead();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the DMA channel 4 and 5 interrupt handler. Channel 4 is the
+/// USART 2 transmit and channel 5 the USART 2 receive.
+///////////////////////////////////////////////////////////////////////////////
+void DMA1_Channel4_5_IRQHandler(void)
+{
+	if ( DMA1->ISR & DMA_ISR_TCIF4 )
+	{
+		DMA1->IFCR = DMA_IFCR_CGIF4;
+		TransmitComplete();
+		Event_Post(Event_Transmit);
+	}
+
+	if ( DMA1->ISR & (DMA_ISR_HTIF5 | DMA_ISR_TCIF5) )
+	{
+		// half or all of the receive buffer is filled
+		DMA1->IFCR = DMA_IFCR_CGIF5;
+		ReceiveDmaUpdate();
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Defines the standard serial functions for usart 2
 ///
@@ -338,5 +856,13 @@ SerialInterface SerialPort2 = {
                                     SendString,
                                     SendArray,
                                     DoesReceiveBufferHaveData,
-                                    GetByte
+                                    GetByte,
+                                    GetArray,
+                                    GetTransmitFreeSpace,
+                                    IsTransmitBusy,
+                                    SendArrayInPlace,
+                                    Setbaudrate,
+                                    GetActualBaudrate,
+                                    GetReceiveOverflowCount,
+                                    GetTransmitFreeDescriptors
                                 };
@@ -0,0 +1,515 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \file Stream.c
+///
+///	\brief Report by exception of the ADC scan
+///
+///	A channel is only reported when it has moved by more than its deadband
+///	from the value last reported, or when nothing has been reported for its
+///	heartbeat time, so the host knows the channel is still alive.
+///
+///	Runs in the main loop on the latest scan vector. Each round takes a new
+///	vector and hands out the channels that are due one at a time, so the
+///	caller can stop when the transmit is full and carry on with the round
+///	later.
+///
+///	Subscriptions sample a channel at a fixed rate instead, scheduled off
+///	the tick. The channels due at the same time are multiplexed into
+///	numbered batches, so the host can tell when one was dropped.
+///
+///	\author Ronald Sousa @Opticalworm
+///////////////////////////////////////////////////////////////////////////////
+#include "Stream.h"
+#include "MCU/tick.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the channels being reported. Bit n set = channel n
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t EnabledMask;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the channels reported at least once since enabled
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t ReportedMask;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the change of each channel that is reported
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t Deadband[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the longest each channel goes unreported. 0 = no heartbeat
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t HeartbeatMs[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the value last reported for each channel
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t ReportedValue[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief when each channel was last reported
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t ReportedMs[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the subscribed channels. Bit n set = channel n
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t SubscribedMask;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the subscription rate of each channel in samples per second
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t Rate[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the whole ms of each channel's subscription period
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t PeriodMs[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the part of each period that doesn't fit in whole ms. Over Rate
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t PeriodRemainder[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the remainders not yet added to the due time. Over Rate
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t PeriodError[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief when each subscribed channel is next due
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t DueMs[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the next channel to check for a batch. ADC_NUMBER_OF_CHANNELS =
+/// start a new round
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t NextSubscribedChannel = ADC_NUMBER_OF_CHANNELS;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief counts the batches
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t BatchSequence;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the round's scan vector, indexed by channel
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t RoundValue[ADC_NUMBER_OF_CHANNELS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the channels in the round's scan vector
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t RoundMask;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief when the round's scan vector was taken
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t RoundMs;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the next channel to check. ADC_NUMBER_OF_CHANNELS = start a new
+/// round
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t NextChannel = ADC_NUMBER_OF_CHANNELS;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief take the latest scan vector for a new round. The exception and
+/// subscription rounds of the same tick share it
+///
+///	\return TRUE success. FALSE no vector
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t StartRound(void)
+{
+	uint16_t Vector[ADC_NUMBER_OF_CHANNELS];
+	uint32_t Now = Tick_GetMs();
+	uint32_t Mask;
+	uint32_t Count;
+	uint32_t Channel;
+	uint32_t Index = 0;
+
+	if ( RoundMask && Now == RoundMs && RoundMask == ADC_Scan_GetChannelMask() )
+	{
+		return TRUE;
+	}
+
+	Mask = ADC_Scan_GetChannelMask();
+	Count = ADC_Scan_GetLatest(&Vector[0]);
+
+	// the scan must not have changed under us
+	if ( !Count || Mask != ADC_Scan_GetChannelMask() )
+	{
+		RoundMask = 0;
+		return FALSE;
+	}
+
+	RoundMask = Mask;
+	RoundMs = Now;
+
+	// the vector is in channel number order
+	for ( Channel = 0; Mask; Channel++, Mask >>= 1 )
+	{
+		if ( Mask & 1 )
+		{
+			RoundValue[Channel] = Vector[Index++];
+		}
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief there is no scan vector for the round. The scan is stopped or a
+/// software scan hasn't been triggered yet. Move the heartbeats and
+/// subscriptions that are due on by a period, as if they had been served,
+/// so Stream_GetIdleMs doesn't keep the core awake waiting for a vector.
+///////////////////////////////////////////////////////////////////////////////
+static void SkipRound(void)
+{
+	uint32_t Now = Tick_GetMs();
+	uint32_t Channel;
+
+	for ( Channel = 0; Channel < ADC_NUMBER_OF_CHANNELS; Channel++ )
+	{
+		if ( (EnabledMask & ReportedMask & ((uint32_t)1 << Channel)) && HeartbeatMs[Channel] &&
+			(Now - ReportedMs[Channel]) >= HeartbeatMs[Channel] )
+		{
+			ReportedMs[Channel] = Now;
+		}
+
+		if ( (SubscribedMask & ((uint32_t)1 << Channel)) && (int32_t)(Now - DueMs[Channel]) >= 0 )
+		{
+			DueMs[Channel] = Now + PeriodMs[Channel];
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief check if a channel is due
+///
+///	\param channel the channel. Must be enabled and in the round
+///
+///	\return TRUE report it
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t IsDue(uint32_t channel)
+{
+	uint32_t Value = RoundValue[channel];
+	uint32_t Reported = ReportedValue[channel];
+
+	if ( !(ReportedMask & ((uint32_t)1 << channel)) )
+	{
+		return TRUE;
+	}
+
+	if ( ((Value > Reported) ? (Value - Reported) : (Reported - Value)) > Deadband[channel] )
+	{
+		return TRUE;
+	}
+
+	if ( HeartbeatMs[channel] && (RoundMs - ReportedMs[channel]) >= HeartbeatMs[channel] )
+	{
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief report a channel of the scan by exception
+///
+///	\param channel the ADC channel. Only reported while the scan includes it
+///	\param deadband the change in counts that is reported. 0 = any change
+///	\param heartbeatMs report at least this often. 0 = only on change
+///
+///	\return TRUE success. FALSE bad parameters
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t Stream_SetChannel(uint32_t channel, uint32_t deadband, uint32_t heartbeatMs)
+{
+	if ( channel >= ADC_NUMBER_OF_CHANNELS || deadband > ADC_MAX_SAMPLE )
+	{
+		return FALSE;
+	}
+
+	Deadband[channel] = (uint16_t)deadband;
+	HeartbeatMs[channel] = heartbeatMs;
+
+	// report the current value straight away
+	ReportedMask &= ~((uint32_t)1 << channel);
+	EnabledMask |= (uint32_t)1 << channel;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief stop reporting a channel
+///
+///	\param channel the ADC channel
+///////////////////////////////////////////////////////////////////////////////
+void Stream_ClearChannel(uint32_t channel)
+{
+	if ( channel < ADC_NUMBER_OF_CHANNELS )
+	{
+		EnabledMask &= ~((uint32_t)1 << channel);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief stop reporting every channel
+///////////////////////////////////////////////////////////////////////////////
+void Stream_Stop(void)
+{
+	EnabledMask = 0;
+	NextChannel = ADC_NUMBER_OF_CHANNELS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief take the next channel that is due. Call again until it returns
+/// FALSE, which ends the round. The sample taken counts as reported.
+///
+///	\param destination where to put the sample
+///
+///	\return TRUE a sample is due. FALSE none left in this round
+///	ERROR_INVALID_POINTER = Invalid destination pointer
+///////////////////////////////////////////////////////////////////////////////
+int_fast8_t Stream_Read(StreamSampleType *destination)
+{
+	uint32_t Channel;
+
+	if ( !destination )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	if ( ADC_NUMBER_OF_CHANNELS <= NextChannel )
+	{
+		if ( !EnabledMask )
+		{
+			return FALSE;
+		}
+
+		if ( TRUE != StartRound() )
+		{
+			SkipRound();
+			return FALSE;
+		}
+
+		NextChannel = 0;
+	}
+
+	for ( Channel = NextChannel; Channel < ADC_NUMBER_OF_CHANNELS; Channel++ )
+	{
+		if ( (EnabledMask & RoundMask & ((uint32_t)1 << Channel)) && TRUE == IsDue(Channel) )
+		{
+			ReportedValue[Channel] = RoundValue[Channel];
+			ReportedMs[Channel] = RoundMs;
+			ReportedMask |= (uint32_t)1 << Channel;
+
+			destination->Channel = Channel;
+			destination->Value = RoundValue[Channel];
+			destination->TimestampMs = RoundMs;
+
+			NextChannel = Channel + 1;
+			return TRUE;
+		}
+	}
+
+	NextChannel = ADC_NUMBER_OF_CHANNELS;
+
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief sample a channel of the scan at a fixed rate. The samples of all
+/// the subscribed channels come out of Stream_ReadBatch.
+///
+///	\param channel the ADC channel. Only sampled while the scan includes it
+///	\param rate samples per second. 1 to STREAM_MAX_RATE
+///
+///	\return TRUE success. FALSE bad parameters
+///////////////////////////////////////////////////////////////////////////////
+uint_fast8_t Stream_Subscribe(uint32_t channel, uint32_t rate)
+{
+	if ( channel >= ADC_NUMBER_OF_CHANNELS || !rate || rate > STREAM_MAX_RATE )
+	{
+		return FALSE;
+	}
+
+	Rate[channel] = (uint16_t)rate;
+	PeriodMs[channel] = (uint16_t)(1000 / rate);
+	PeriodRemainder[channel] = (uint16_t)(1000 % rate);
+	PeriodError[channel] = 0;
+	DueMs[channel] = Tick_GetMs();
+
+	SubscribedMask |= (uint32_t)1 << channel;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief stop sampling a channel
+///
+///	\param channel the ADC channel
+///////////////////////////////////////////////////////////////////////////////
+void Stream_Unsubscribe(uint32_t channel)
+{
+	if ( channel < ADC_NUMBER_OF_CHANNELS )
+	{
+		SubscribedMask &= ~((uint32_t)1 << channel);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief stop sampling every channel
+///////////////////////////////////////////////////////////////////////////////
+void Stream_UnsubscribeAll(void)
+{
+	SubscribedMask = 0;
+	NextSubscribedChannel = ADC_NUMBER_OF_CHANNELS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief move a channel's due time on by one period. The whole ms and the
+/// remainder are added apart so the average rate is exact.
+///
+///	\param channel the ADC channel
+///////////////////////////////////////////////////////////////////////////////
+static void NextDue(uint32_t channel)
+{
+	DueMs[channel] += PeriodMs[channel];
+	PeriodError[channel] += PeriodRemainder[channel];
+
+	if ( PeriodError[channel] >= Rate[channel] )
+	{
+		PeriodError[channel] -= Rate[channel];
+		DueMs[channel]++;
+	}
+
+	if ( (int32_t)(RoundMs - DueMs[channel]) > (int32_t)PeriodMs[channel] )
+	{
+		// fell more than a period behind. Don't try to catch up with a burst
+		DueMs[channel] = RoundMs + PeriodMs[channel];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief take the next batch of subscribed samples that are due. Call
+/// again until it returns FALSE, which ends the round. Every batch taken
+/// gets the next sequence number, so a batch the caller can't send shows up
+/// at the host as a gap.
+///
+///	\param destination where to put the batch
+///
+///	\return TRUE a batch is due. FALSE none left in this round
+///	ERROR_INVALID_POINTER = Invalid destination pointer
+///////////////////////////////////////////////////////////////////////////////
+int_fast8_t Stream_ReadBatch(StreamBatchType *destination)
+{
+	uint32_t Channel;
+	uint32_t Count = 0;
+
+	if ( !destination )
+	{
+		return ERROR_INVALID_POINTER;
+	}
+
+	if ( ADC_NUMBER_OF_CHANNELS <= NextSubscribedChannel )
+	{
+		if ( !SubscribedMask )
+		{
+			return FALSE;
+		}
+
+		if ( TRUE != StartRound() )
+		{
+			SkipRound();
+			return FALSE;
+		}
+
+		NextSubscribedChannel = 0;
+	}
+
+	for ( Channel = NextSubscribedChannel; Channel < ADC_NUMBER_OF_CHANNELS && Count < STREAM_MAX_BATCH; Channel++ )
+	{
+		if ( (SubscribedMask & RoundMask & ((uint32_t)1 << Channel)) && (int32_t)(RoundMs - DueMs[Channel]) >= 0 )
+		{
+			destination->Channel[Count] = (uint8_t)Channel;
+			destination->Value[Count] = RoundValue[Channel];
+			Count++;
+
+			NextDue(Channel);
+		}
+	}
+
+	NextSubscribedChannel = (ADC_NUMBER_OF_CHANNELS > Channel) ? Channel : ADC_NUMBER_OF_CHANNELS;
+
+	if ( !Count )
+	{
+		NextSubscribedChannel = ADC_NUMBER_OF_CHANNELS;
+		return FALSE;
+	}
+
+	destination->Sequence = BatchSequence++;
+	destination->TimestampMs = RoundMs;
+	destination->NumberOfSamples = Count;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief return how long the core can sleep before a subscription or a
+/// heartbeat is due. A change past a deadband comes with a new scan block,
+/// whose interrupt wakes the core anyway. Channels outside the scan can't
+/// be served, so they don't count.
+///
+///	\return ms to the next due time. 0 = due now. 1 = a round is waiting
+///	for transmit space. TICK_IDLE_FOREVER = nothing timed or no scan
+///////////////////////////////////////////////////////////////////////////////
+uint32_t Stream_GetIdleMs(void)
+{
+	uint32_t Now = Tick_GetMs();
+	uint32_t ScanMask = ADC_Scan_GetChannelMask();
+	uint32_t IdleMs = TICK_IDLE_FOREVER;
+	uint32_t DueIn;
+	uint32_t Channel;
+
+	if ( ADC_NUMBER_OF_CHANNELS > NextChannel || ADC_NUMBER_OF_CHANNELS > NextSubscribedChannel )
+	{
+		return 1;
+	}
+
+	if ( !ScanMask )
+	{
+		return TICK_IDLE_FOREVER;
+	}
+
+	for ( Channel = 0; Channel < ADC_NUMBER_OF_CHANNELS; Channel++ )
+	{
+		if ( !(ScanMask & ((uint32_t)1 << Channel)) )
+		{
+			continue;
+		}
+
+		if ( SubscribedMask & ((uint32_t)1 << Channel) )
+		{
+			DueIn = ((int32_t)(DueMs[Channel] - Now) > 0) ? (DueMs[Channel] - Now) : 0;
+
+			if ( DueIn < IdleMs )
+			{
+				IdleMs = DueIn;
+			}
+		}
+
+		if ( (EnabledMask & ReportedMask & ((uint32_t)1 << Channel)) && HeartbeatMs[Channel] )
+		{
+			DueIn = Now - ReportedMs[Channel];
+			DueIn = (DueIn < HeartbeatMs[Channel]) ? (HeartbeatMs[Channel] - DueIn) : 0;
+
+			if ( DueIn < IdleMs )
+			{
+				IdleMs = DueIn;
+			}
+		}
+	}
+
+	return IdleMs;
+}
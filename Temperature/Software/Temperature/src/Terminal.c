@@ -3,367 +3,2025 @@
 ///
 ///	\author Ronald Sousa @Opticalworm
 ///////////////////////////////////////////////////////////////////////////////
+#include <string.h>
 #include "common.h"
 #include "MCU/led.h"
 #include "MCU/usart2.h"
 #include "MCU/tick.h"
+#include "MCU/timer.h"
 #include "MCU/adc.h"
+#include "MCU/crc.h"
+#include "COBS.h"
+#include "Decimator.h"
+#include "Capture.h"
+#include "History.h"
+#include "Stream.h"
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief Defines our terminal buffer size which in turn set the longest command
+/// \brief Defines how many bytes are taken from the serial port in one go
 ///////////////////////////////////////////////////////////////////////////////
-#define TERMINAL_BUFFER_SIZE 25
+#define TERMINAL_READ_BLOCK_SIZE 16
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief Keep track of the number of bytes we received from the computer
+/// \brief the transmit space needed to send one more report by exception.
+/// The longer of the ASCII line and the frame
 ///////////////////////////////////////////////////////////////////////////////
-static uint32_t NumberOfByteReceived;
+#define TERMINAL_STREAM_MIN_FREE 40
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief The terminal data buffer
+/// \brief the transmit space needed to send a full subscription batch. The
+/// longer of the ASCII line and the frame
 ///////////////////////////////////////////////////////////////////////////////
-static uint8_t Buffer[TERMINAL_BUFFER_SIZE];
+#define TERMINAL_BATCH_MIN_FREE 100
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief define the number of characters we can hold on the string
+/// \brief the transmit space needed to send a decimated scan of every
+/// channel. The longer of the ASCII line and the frame
 ///////////////////////////////////////////////////////////////////////////////
-#define PARAMETER_STRING_SIZE 20
+#define TERMINAL_DECIMATE_MIN_FREE 140
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief define the max number of parameters
+/// \brief define the max number of parameters, including the command itself
 ///////////////////////////////////////////////////////////////////////////////
-#define MAX_NUMBER_OF_PARAMETERS 10
+#define MAX_NUMBER_OF_PARAMETERS 6
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief define the number of fraction digits kept by fixed point parameters
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_FIXED_POINT_DIGITS 3
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief a fixed point parameter value is the number times this scale
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_FIXED_POINT_SCALE 1000
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the largest value before one more digit would overflow an int32
+///////////////////////////////////////////////////////////////////////////////
+#define PARSER_MAX_VALUE_BEFORE_DIGIT 214748364
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the baudrate the terminal starts with
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_DEFAULT_BAUDRATE 115200
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the largest baudrate error we accept, in parts per million
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_MAX_BAUDRATE_ERROR_PPM 20000
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief how long the host has to send a command at the new baudrate before
+/// we go back to the old one
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_BAUDRATE_CONFIRM_MS 2000
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief how long a command waits for its ADC conversion before it fails
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_CONVERSION_TIMEOUT_MS 5
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Defines the baudrate negotiation states
+///////////////////////////////////////////////////////////////////////////////
+typedef enum {
+	BaudrateState_Idle = 0,			///< no change in progress
+	BaudrateState_SwitchPending,	///< accepted. Switch once the reply has been sent
+	BaudrateState_ConfirmPending,	///< switched. Waiting for the host to talk at the new rate
+} BaudrateStateType;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the baudrate negotiation state
+///////////////////////////////////////////////////////////////////////////////
+static BaudrateStateType BaudrateState;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the baudrate in use. Also the one we return to if the host doesn't
+/// confirm a new rate
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t CurrentBaudrate;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the baudrate waiting to be switched to
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t NewBaudrate;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief times out the new baudrate confirmation
+///////////////////////////////////////////////////////////////////////////////
+static TimerType BaudrateConfirmTimer;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief times out the conversion of a pending command
+///////////////////////////////////////////////////////////////////////////////
+static TimerType ConversionTimer;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief a command handler returns this when it has started something that
+/// finishes later. The handler sets PendingCommand, and the reply is sent and
+/// the next command read once that returns TRUE or FALSE
+///////////////////////////////////////////////////////////////////////////////
+#define COMMAND_PENDING 2
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the most values a command can reply with. Enough for a timestamp
+/// and a scan of every ADC channel
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_MAX_REPLY_VALUES (ADC_NUMBER_OF_CHANNELS + 1)
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the longest ASCII line. Up to 11 characters and a separator per
+/// value, the line end and the string terminator
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_MAX_LINE_LENGTH ((TERMINAL_MAX_REPLY_VALUES * 12) + 2)
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief binary frame layout. All the values are little endian int32 and the
+/// whole frame is COBS encoded and ends with a zero byte.
+///
+///		command:	[S number][sequence][parameter]...[crc32]
+///		reply:		[S number][sequence][status][value]...[crc32]
+///		stream:		[S number | FRAME_UNSOLICITED][stream sequence][TRUE][value]...[crc32]
+///
+/// The sequence byte is copied into the reply so the host can match them up.
+/// Stream frames count their own sequence so the host can spot a lost one.
+/// The status is the command result, TRUE or FALSE. The CRC-32 covers all the
+/// bytes before it. Frames with a bad CRC are dropped without a reply.
+///////////////////////////////////////////////////////////////////////////////
+#define FRAME_COMMAND_HEADER_SIZE 2
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of bytes before the values in a reply frame
+///////////////////////////////////////////////////////////////////////////////
+#define FRAME_REPLY_HEADER_SIZE 3
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief set in the S number of frames the host didn't ask for
+///////////////////////////////////////////////////////////////////////////////
+#define FRAME_UNSOLICITED 0x80
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of bytes in the frame CRC
+///////////////////////////////////////////////////////////////////////////////
+#define FRAME_CRC_SIZE 4
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the largest reply frame before encoding
+///////////////////////////////////////////////////////////////////////////////
+#define FRAME_MAX_REPLY_SIZE (FRAME_REPLY_HEADER_SIZE + (TERMINAL_MAX_REPLY_VALUES * 4) + FRAME_CRC_SIZE)
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the receive frame buffer size. Longer frames are dropped
+///////////////////////////////////////////////////////////////////////////////
+#define FRAME_RECEIVE_BUFFER_SIZE 64
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Defines the terminal modes
+///////////////////////////////////////////////////////////////////////////////
+typedef enum {
+	TerminalMode_Ascii = 0,		///< human readable commands and replies
+	TerminalMode_Binary,		///< COBS framed binary records
+} TerminalModeType;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the terminal mode in use
+///////////////////////////////////////////////////////////////////////////////
+static TerminalModeType TerminalMode;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the mode to change to once the command reply has been sent
+///////////////////////////////////////////////////////////////////////////////
+static TerminalModeType NewTerminalMode;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the reply values collected while a binary command runs
+///////////////////////////////////////////////////////////////////////////////
+static int32_t ReplyValues[TERMINAL_MAX_REPLY_VALUES];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of values in ReplyValues
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t NumberOfReplyValues;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the sequence number of the next stream frame
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t StreamSequence;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the alarm change count last sent to the host
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t AlarmChangeCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief TRUE while the capture buffer is being sent in place. It can't be
+/// armed again until the transmit is done
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t CaptureSending;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief polls the command waiting to finish. 0 = none. Returns TRUE or
+/// FALSE once done, otherwise COMMAND_PENDING
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t (*PendingCommand)(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the S number of the command being run
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t CommandNumber;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the sequence number of the binary command being run
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t CommandSequence;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the received bytes not processed yet. A pending command holds the
+/// rest of the block back
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t ReadBuffer[TERMINAL_READ_BLOCK_SIZE];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of bytes in ReadBuffer
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t ReadCount;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the next byte to process in ReadBuffer
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t ReadIndex;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief holds the encoded frame as it arrives
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t FrameBuffer[FRAME_RECEIVE_BUFFER_SIZE];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of frame bytes received. Larger than the buffer when the
+/// frame is too long
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t FrameLength;
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the terminal command list. This is the only place a command needs
+/// adding. The dispatch table, the argument checks and the help text shown on
+/// the terminal are all generated from it.
+///
+/// Each entry is X(number, handler, parameter types, minimum parameters, help)
+///		- number: the S value. Must follow the list order starting at 1
+///		- handler: the function that runs the command
+///		- parameter types: one lower case type letter per parameter
+///		- minimum parameters: how many of the parameters must be given
+///		- help: the help text
+///////////////////////////////////////////////////////////////////////////////
+#define TERMINAL_COMMAND_LIST(X) \
+	X(1, Command_LEDControl,	"u",	0,	"LED Control: U0 = led state") \
+	X(2, Command_ADCOn,			"",		0,	"ADC On") \
+	X(3, Command_ADCOff,		"",		0,	"ADC Off") \
+	X(4, Command_ADCSample,		"u",	1,	"ADC Sample: U0 = channel") \
+	X(5, Command_Baudrate,		"u",	1,	"Baudrate: U0 = baudrate") \
+	X(6, Command_BinaryMode,	"u",	1,	"Binary Mode: U0 = 1 on, 0 off") \
+	X(7, Command_ScanStart,		"uu",	1,	"Scan Start: U0 = channel mask, U1 = 0 continuous, 1 triggered, 2 timer") \
+	X(8, Command_ScanStop,		"",		0,	"Scan Stop") \
+	X(9, Command_ScanTrigger,	"",		0,	"Scan Trigger") \
+	X(10, Command_ScanLatest,	"",		0,	"Scan Latest") \
+	X(11, Command_ScanRate,		"u",	1,	"Scan Rate: U0 = scans per second") \
+	X(12, Command_Temperature,	"",		0,	"Temperature: centi-degrees and supply mV") \
+	X(13, Command_Decimate,		"u",	0,	"Decimate: stream the scan summed over 2^U0 vectors. No U0 = stop") \
+	X(14, Command_Alarm,		"uuuu",	0,	"Alarm: U0 = channel, U1 = low, U2 = high, U3 = hysteresis. No U0 = off") \
+	X(15, Command_Profile,		"uuuu",	1,	"Profile: U0 = channel, U1 = sample time 0-7, U2 = 12, 10, 8 or 6 bits, U3 = 1 left aligned") \
+	X(16, Command_Capture,		"uuuuu",0,	"Capture: U0 = trigger vector position, U1 = 0 rising, 1 falling, 2 slope, U2 = level, U3 = pre, U4 = post vectors. No U0 = state") \
+	X(17, Command_CaptureRead,	"",		0,	"Capture Read: binary mode only") \
+	X(18, Command_History,		"u",	0,	"History: average 2^U0 scans per temperature sample. No U0 = stop") \
+	X(19, Command_HistoryStats,	"u",	1,	"History Stats: U0 = window. Count, mean, min, max, std dev, latest") \
+	X(20, Command_Exception,	"uuu",	0,	"Exception: U0 = channel, U1 = deadband, U2 = heartbeat ms. No U1 = channel off, no U0 = all off") \
+	X(21, Command_Subscribe,	"uu",	0,	"Subscribe: U0 = channel, U1 = samples per second. No U1 = channel off, no U0 = all off") \
+	X(22, Command_Status,		"",		0,	"Status: receive overflows, decimator overflows")
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief generates the command's help line
+///////////////////////////////////////////////////////////////////////////////
+#define COMMAND_HELP(number, handler, types, minimum, help) "S" #number " - " help "\r\n"
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief generates the command's position in the list
+///////////////////////////////////////////////////////////////////////////////
+#define COMMAND_INDEX(number, handler, types, minimum, help) CommandIndex_##handler,
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief fails the build if a command number doesn't match its position,
+/// which the O(1) dispatch relies on
+///////////////////////////////////////////////////////////////////////////////
+#define COMMAND_NUMBER_CHECK(number, handler, types, minimum, help) \
+	typedef char CommandNumberCheck_##handler[((number) == (CommandIndex_##handler + 1)) ? 1 : -1];
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief generates the command's dispatch table entry
+///////////////////////////////////////////////////////////////////////////////
+#define COMMAND_ENTRY(number, handler, types, minimum, help) { handler, types, minimum },
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the command positions in the command table
+///////////////////////////////////////////////////////////////////////////////
+enum {
+	TERMINAL_COMMAND_LIST(COMMAND_INDEX)
+	NUMBER_OF_COMMANDS
+};
+
+TERMINAL_COMMAND_LIST(COMMAND_NUMBER_CHECK)
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief this message has the system information data that we want to display
+/// on the terminal
+///////////////////////////////////////////////////////////////////////////////
+static const uint8_t SystemMessageString[] = "-----------------------------------\r\n"
+											"Firm : " FIRMWARE_VERSION "\r\n"
+											"Hard : " HARDWARE_VERSION "\r\n"
+											COMPILED_DATA_TIME "\r\n"
+											"-----------------------------------\r\n"
+											TERMINAL_COMMAND_LIST(COMMAND_HELP);
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Defines the parameter data type
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	uint8_t Type;			///< Parameter data type in lower case. s = command, u = integer, f = fixed point
+	int32_t Value;			///< parameter data. f values are scaled by TERMINAL_FIXED_POINT_SCALE
+} ParamStructureType;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Defines the list of parameter data structure
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+
+	uint32_t NumberOfParameter;		///< used to keep track of the number of parameter we haver
+	ParamStructureType List[MAX_NUMBER_OF_PARAMETERS];	///< hold the parameter
+} ListOfParameterStructureType;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief holds our current list of parameter. Filled in as the bytes arrive
+///
+///	\sa ParserFeed
+///////////////////////////////////////////////////////////////////////////////
+static ListOfParameterStructureType ParameterList;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Defines the command parser states
+///////////////////////////////////////////////////////////////////////////////
+typedef enum {
+	ParserState_Type = 0,	///< waiting for the parameter type letter
+	ParserState_Sign,		///< got the type letter. A '-' or the first digit may follow
+	ParserState_Integer,	///< reading the whole number digits
+	ParserState_Fraction,	///< reading the fixed point fraction digits
+	ParserState_Error,		///< the command is bad. Ignore the rest of the line
+} ParserStateType;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the command parser state
+///////////////////////////////////////////////////////////////////////////////
+static ParserStateType ParserState;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief TRUE when the parameter being read is negative
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t ParserNegative;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of digits read for the parameter
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t ParserNumberOfDigits;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief number of fraction digits read for the fixed point parameter
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t ParserFractionDigits;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief powers of ten used to scale the fixed point fraction
+///////////////////////////////////////////////////////////////////////////////
+static const int32_t FractionScale[TERMINAL_FIXED_POINT_DIGITS + 1] = { 1, 10, 100, 1000 };
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the largest fixed point value that can still be scaled by the
+/// matching FractionScale entry
+///////////////////////////////////////////////////////////////////////////////
+static const int32_t FractionLimit[TERMINAL_FIXED_POINT_DIGITS + 1] = { INT32_MAX, INT32_MAX / 10, INT32_MAX / 100, INT32_MAX / 1000 };
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief clear the parameter list and get ready for a new command
+///////////////////////////////////////////////////////////////////////////////
+static void ParserReset(void)
+{
+	ParameterList.NumberOfParameter = 0;
+	ParserState = ParserState_Type;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief finish the parameter being read and add it to the list
+///
+///	\return TRUE success or no parameter in progress. FALSE the parameter has
+///	no digits
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t ParserEndParameter(void)
+{
+	ParamStructureType *Parameter = &ParameterList.List[ParameterList.NumberOfParameter];
+
+	if ( ParserState_Type == ParserState )
+	{
+		// nothing in progress
+		return TRUE;
+	}
+
+	if ( ParserState_Error == ParserState || !ParserNumberOfDigits )
+	{
+		return FALSE;
+	}
+
+	if ( 'f' == Parameter->Type )
+	{
+		// scale to the fixed point. Any missing fraction digits are zero
+		if ( Parameter->Value > FractionLimit[TERMINAL_FIXED_POINT_DIGITS - ParserFractionDigits] )
+		{
+			return FALSE;
+		}
+
+		Parameter->Value *= FractionScale[TERMINAL_FIXED_POINT_DIGITS - ParserFractionDigits];
+	}
+
+	if ( ParserNegative )
+	{
+		Parameter->Value = -Parameter->Value;
+	}
+
+	ParameterList.NumberOfParameter++;
+	ParserState = ParserState_Type;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief feed one command byte into the parser. The values are worked out as
+/// the digits arrive so nothing is copied or converted at the end of the line.
+///
+/// A command is a list of parameters split by spaces. Each parameter is a type
+/// letter followed by a number, for example "S4 U16" or "S9 F-1.25".
+///
+///	\param data the received byte. Must not be the carriage return
+///
+///	\sa ParserEndCommand
+///////////////////////////////////////////////////////////////////////////////
+static void ParserFeed(uint8_t data)
+{
+	ParamStructureType *Parameter = &ParameterList.List[ParameterList.NumberOfParameter];
+	int32_t Digit;
+
+	if ( ParserState_Error == ParserState )
+	{
+		return;
+	}
+
+	if ( ' ' == data )
+	{
+		if ( TRUE != ParserEndParameter() )
+		{
+			ParserState = ParserState_Error;
+		}
+		return;
+	}
+
+	if ( ParserState_Type == ParserState )
+	{
+		if ( ParameterList.NumberOfParameter >= MAX_NUMBER_OF_PARAMETERS )
+		{
+			ParserState = ParserState_Error;
+			return;
+		}
+
+		// convert to lower case
+		if ( data >= 'A' && data <= 'Z' )
+		{
+			data += 32;
+		}
+
+		if ( 's' != data && 'u' != data && 'f' != data )
+		{
+			ParserState = ParserState_Error;
+			return;
+		}
+
+		Parameter->Type = data;
+		Parameter->Value = 0;
+		ParserNegative = FALSE;
+		ParserNumberOfDigits = 0;
+		ParserFractionDigits = 0;
+		ParserState = ParserState_Sign;
+		return;
+	}
+
+	if ( '-' == data && ParserState_Sign == ParserState )
+	{
+		ParserNegative = TRUE;
+		ParserState = ParserState_Integer;
+		return;
+	}
+
+	if ( '.' == data && 'f' == Parameter->Type && ParserState_Fraction != ParserState )
+	{
+		ParserState = ParserState_Fraction;
+		return;
+	}
+
+	if ( data < '0' || data > '9' )
+	{
+		ParserState = ParserState_Error;
+		return;
+	}
+
+	Digit = data - '0';
+
+	if ( ParserState_Fraction == ParserState )
+	{
+		if ( ParserFractionDigits >= TERMINAL_FIXED_POINT_DIGITS )
+		{
+			// beyond the fixed point precision. drop the digit
+			return;
+		}
+		ParserFractionDigits++;
+	}
+	else
+	{
+		ParserState = ParserState_Integer;
+	}
+
+	// keep the value within an int32
+	if ( Parameter->Value > PARSER_MAX_VALUE_BEFORE_DIGIT ||
+		( PARSER_MAX_VALUE_BEFORE_DIGIT == Parameter->Value && Digit > 7 ) )
+	{
+		ParserState = ParserState_Error;
+		return;
+	}
+
+	Parameter->Value = (Parameter->Value * 10) + Digit;
+	ParserNumberOfDigits++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the carriage return has arrived. Finish the last parameter.
+///
+///	\return TRUE a valid command is ready in ParameterList. FALSE empty line
+///	ERROR the command is bad
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t ParserEndCommand(void)
+{
+	if ( TRUE != ParserEndParameter() )
+	{
+		return ERROR;
+	}
+
+	if ( !ParameterList.NumberOfParameter )
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Send the system information to the computer. This first clear the
+///	computer terminal screen.
+///////////////////////////////////////////////////////////////////////////////
+static void DisplaySystemInformation(void)
+{
+	SerialPort2.SendByte(0x0C); // clear terminal
+    SerialPort2.SendArrayInPlace(&SystemMessageString[0], sizeof(SystemMessageString) - 1);
+	// Send new line feed and prompt
+	SerialPort2.SendString((uint8_t*)"\n> ");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Init the terminal program
+///////////////////////////////////////////////////////////////////////////////
+void Terminal_Init(void)
+{
+    Led_Init();
+    Tick_init();
+    SerialPort2.Open(TERMINAL_DEFAULT_BAUDRATE);
+
+    CurrentBaudrate = TERMINAL_DEFAULT_BAUDRATE;
+    BaudrateState = BaudrateState_Idle;
+
+    CRC32_Init();
+    Capture_Init();
+    TerminalMode = TerminalMode_Ascii;
+    NewTerminalMode = TerminalMode_Ascii;
+    FrameLength = 0;
+
+    ParserReset();
+    DisplaySystemInformation();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief send values as a tab separated line. The line is sent whole or not
+/// at all, so the host never sees part of one.
+///
+///	\param values the values to send
+///	\param count number of values. Up to TERMINAL_MAX_REPLY_VALUES
+///
+///	\return TRUE sent. FALSE too many values or no room in the transmit fifo
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t SendLine(const int32_t *values, uint32_t count)
+{
+	uint8_t Line[TERMINAL_MAX_LINE_LENGTH];
+	uint32_t Length = 0;
+	uint32_t Index;
+
+	if ( count > TERMINAL_MAX_REPLY_VALUES )
+	{
+		return FALSE;
+	}
+
+	if ( !count )
+	{
+		return TRUE;
+	}
+
+	for ( Index = 0; Index < count; Index++ )
+	{
+		Length += (uint32_t)snprintf((char *)&Line[Length], sizeof(Line) - Length, "%ld%s", (long)values[Index],
+										((Index + 1) < count) ? "\t" : "\n\r");
+	}
+
+	// SendArray only queues it if all of it fits
+	return SerialPort2.SendArray(&Line[0], Length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief read a little endian int32 from a frame
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t ReadLittleEndian32(const uint8_t *source)
+{
+	return (uint32_t)source[0] | ((uint32_t)source[1] << 8) | ((uint32_t)source[2] << 16) | ((uint32_t)source[3] << 24);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief write a little endian int32 into a frame
+///////////////////////////////////////////////////////////////////////////////
+static void WriteLittleEndian32(uint8_t *destination, uint32_t value)
+{
+	destination[0] = (uint8_t)value;
+	destination[1] = (uint8_t)(value >> 8);
+	destination[2] = (uint8_t)(value >> 16);
+	destination[3] = (uint8_t)(value >> 24);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief send a binary frame
+///
+///	\param command the S number
+///	\param sequence the sequence number
+///	\param status the command result
+///	\param values the values to send
+///	\param count number of values. Up to TERMINAL_MAX_REPLY_VALUES
+///
+///	\return TRUE queued. FALSE no room in the transmit fifo
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t SendFrame(uint8_t command, uint8_t sequence, int_fast8_t status, const int32_t *values, uint32_t count)
+{
+	uint8_t Frame[FRAME_MAX_REPLY_SIZE];
+	uint8_t EncodedFrame[COBS_MAX_ENCODED_LENGTH(FRAME_MAX_REPLY_SIZE) + 1];
+	uint32_t Length = FRAME_REPLY_HEADER_SIZE;
+	uint32_t Index;
+
+	Frame[0] = command;
+	Frame[1] = sequence;
+	Frame[2] = (uint8_t)status;
+
+	for ( Index = 0; Index < count && Index < TERMINAL_MAX_REPLY_VALUES; Index++ )
+	{
+		WriteLittleEndian32(&Frame[Length], (uint32_t)values[Index]);
+		Length += 4;
+	}
+
+	WriteLittleEndian32(&Frame[Length], CRC32_Calculate(&Frame[0], Length));
+	Length += FRAME_CRC_SIZE;
+
+	Length = COBS_Encode(&Frame[0], Length, &EncodedFrame[0]);
+	EncodedFrame[Length++] = 0;
+
+	// all or nothing. The host resends if the reply never comes and a
+	// dropped stream frame shows as a gap in the sequence
+	return SerialPort2.SendArray(&EncodedFrame[0], Length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief send the command's reply values. In ASCII mode they are sent as a
+/// tab separated line. In binary mode they are kept and sent in the reply
+/// frame once the command is done.
+///
+///	\param values the values to send
+///	\param count number of values
+///////////////////////////////////////////////////////////////////////////////
+static void SendReply(const int32_t *values, uint32_t count)
+{
+	uint32_t Index;
+
+	if ( TerminalMode_Ascii == TerminalMode )
+	{
+		SendLine(values, count);
+		return;
+	}
+
+	for ( Index = 0; Index < count && NumberOfReplyValues < TERMINAL_MAX_REPLY_VALUES; Index++ )
+	{
+		ReplyValues[NumberOfReplyValues++] = values[Index];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief send values the host didn't ask for, such as streamed data. In
+/// binary mode they go in a frame of their own marked FRAME_UNSOLICITED.
+///
+///	\param command the S number of the command that started the stream
+///	\param values the values to send
+///	\param count number of values
+///
+///	\return TRUE queued. FALSE no room in the transmit fifo
+///////////////////////////////////////////////////////////////////////////////
+static uint_fast8_t SendStream(uint8_t command, const int32_t *values, uint32_t count)
+{
+	if ( TerminalMode_Ascii == TerminalMode )
+	{
+		return SendLine(values, count);
+	}
+
+	return SendFrame(command | FRAME_UNSOLICITED, StreamSequence++, TRUE, values, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief handle the host's request for a new baudrate. Reply with the
+/// requested rate, the rate we can really achieve and the error in ppm so the
+/// host can reject it.
+///
+/// Once accepted the switch happens after the reply has been sent. The host
+/// then has TERMINAL_BAUDRATE_CONFIRM_MS to send any command at the new rate,
+/// otherwise we return to the current rate.
+///
+///	\param baudrate the requested baudrate
+///
+///	\return TRUE accepted. FALSE the rate can't be reached within
+///	TERMINAL_MAX_BAUDRATE_ERROR_PPM
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t RequestBaudrate(uint32_t baudrate)
+{
+	uint32_t ActualBaudrate;
+	int32_t ErrorPpm = 0;
+	int32_t Reply[3];
+
+	ActualBaudrate = SerialPort2.GetActualBaudrate(baudrate);
+
+	if ( ActualBaudrate )
+	{
+		ErrorPpm = (int32_t)((((int64_t)ActualBaudrate - baudrate) * 1000000) / baudrate);
+	}
+
+	Reply[0] = (int32_t)baudrate;
+	Reply[1] = (int32_t)ActualBaudrate;
+	Reply[2] = ErrorPpm;
+	SendReply(&Reply[0], 3);
+
+	if ( !ActualBaudrate || ErrorPpm > TERMINAL_MAX_BAUDRATE_ERROR_PPM || ErrorPpm < -TERMINAL_MAX_BAUDRATE_ERROR_PPM )
+	{
+		return FALSE;
+	}
+
+	NewBaudrate = baudrate;
+	BaudrateState = BaudrateState_SwitchPending;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the host never talked to us at the new rate. Go back to the old
+/// one
+///
+///	\param context not used
+///////////////////////////////////////////////////////////////////////////////
+static void BaudrateNotConfirmed(void *context)
+{
+	(void)context;
+
+	if ( BaudrateState_ConfirmPending == BaudrateState )
+	{
+		SerialPort2.SetBaudrate(CurrentBaudrate);
+		BaudrateState = BaudrateState_Idle;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief move the baudrate negotiation along. Switches once all the replies
+/// at the old rate have left. BaudrateNotConfirmed goes back if the host
+/// never confirms.
+///////////////////////////////////////////////////////////////////////////////
+static void ProcessBaudrateChange(void)
+{
+	switch ( BaudrateState )
+	{
+		case BaudrateState_SwitchPending:
+			if ( !SerialPort2.IsTransmitBusy() )
+			{
+				SerialPort2.SetBaudrate(NewBaudrate);
+				Timer_Start(&BaudrateConfirmTimer, TERMINAL_BAUDRATE_CONFIRM_MS, 0, BaudrateNotConfirmed, 0);
+				BaudrateState = BaudrateState_ConfirmPending;
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S1 command. Set the LED to U0 or toggle it when U0 isn't given
+///
+///	\return TRUE success
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_LEDControl(ListOfParameterStructureType *source)
+{
+	if ( source->NumberOfParameter > 1 )
+	{
+		if ( source->List[1].Value )
+		{
+			Led_On();
+		}
+		else
+		{
+			Led_Off();
+		}
+	}
+	else
+	{
+		Led_Toggle();
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief wait for the ADC to be on
+///
+///	\return TRUE on. FALSE failed. COMMAND_PENDING still turning on
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t PollADCOn(void)
+{
+	switch ( ADC_GetState() )
+	{
+		case ADCState_Ready:
+			return TRUE;
+
+		case ADCState_Off:
+		case ADCState_Error:
+			return FALSE;
+
+		default:
+			return COMMAND_PENDING;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S2 command. Turn the ADC on. Replies once it is ready
+///
+///	\return COMMAND_PENDING started. FALSE already on
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_ADCOn(ListOfParameterStructureType *source)
+{
+	(void)source;
+
+	if ( TRUE != ADC_On() )
+	{
+		return FALSE;
+	}
+
+	PendingCommand = PollADCOn;
+	return COMMAND_PENDING;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief wait for the ADC to be off
+///
+///	\return TRUE off. FALSE failed. COMMAND_PENDING still turning off
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t PollADCOff(void)
+{
+	switch ( ADC_GetState() )
+	{
+		case ADCState_Off:
+			return TRUE;
+
+		case ADCState_Error:
+			return FALSE;
+
+		default:
+			return COMMAND_PENDING;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S3 command. Turn the ADC off. Replies once it is off
+///
+///	\return COMMAND_PENDING started. FALSE already off
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_ADCOff(ListOfParameterStructureType *source)
+{
+	(void)source;
+
+	if ( TRUE != ADC_Off() )
+	{
+		return FALSE;
+	}
+
+	PendingCommand = PollADCOff;
+	return COMMAND_PENDING;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief a command's conversion took longer than
+/// TERMINAL_CONVERSION_TIMEOUT_MS. Cancel it, which fails the command
+///////////////////////////////////////////////////////////////////////////////
+static void ConversionTimedOut(void *context)
+{
+	(void)context;
+
+	ADC_CancelConversion();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief wait for the S4 conversion and send the raw, temperature in
+/// centi-degrees and normalised in parts per million values. All three come
+/// from the one conversion
+///
+///	\return TRUE sent. FALSE failed. COMMAND_PENDING still converting
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t PollADCSample(void)
+{
+	uint16_t Samples[ADC_MAX_CONVERSION_CHANNELS];
+	int32_t Reply[3];
+	int_fast8_t Count;
+
+	Count = ADC_GetConversion(&Samples[0]);
+
+	if ( !Count )
+	{
+		return COMMAND_PENDING;
+	}
+
+	Timer_Cancel(&ConversionTimer);
+
+	if ( Count < 0 )
+	{
+		return FALSE;
+	}
+
+	Reply[0] = (int32_t)Samples[0];
+	Reply[1] = ADC_ReturnCalibratedTemperature(Samples[0]);
+	Reply[2] = (int32_t)ADC_ReturnNormalised(Samples[0]);
+	SendReply(&Reply[0], 3);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S4 command. Sample ADC channel U0. Replies once converted
+///
+///	\return COMMAND_PENDING started. FALSE the ADC is off, busy or bad channel
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_ADCSample(ListOfParameterStructureType *source)
+{
+	if ( (uint32_t)source->List[1].Value >= ADC_NUMBER_OF_CHANNELS ||
+		TRUE != ADC_Convert((uint32_t)1 << source->List[1].Value, 0) )
+	{
+		return FALSE;
+	}
+
+	Timer_Start(&ConversionTimer, TERMINAL_CONVERSION_TIMEOUT_MS, 0, ConversionTimedOut, 0);
+	PendingCommand = PollADCSample;
+	return COMMAND_PENDING;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S5 command. Negotiate baudrate U0
+///
+///	\return TRUE success
+///	\sa RequestBaudrate
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_Baudrate(ListOfParameterStructureType *source)
+{
+	return RequestBaudrate((uint32_t)source->List[1].Value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S6 command. Change to the binary mode when U0 is 1 or back to the
+/// ASCII mode when U0 is 0. The change happens after the reply.
+///
+///	\return TRUE success. FALSE unknown mode
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_BinaryMode(ListOfParameterStructureType *source)
+{
+	switch ( source->List[1].Value )
+	{
+		case 0:
+			NewTerminalMode = TerminalMode_Ascii;
+			break;
+
+		case 1:
+			NewTerminalMode = TerminalMode_Binary;
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S7 command. Scan the channels in mask U0. U1 selects continuous
+/// (default), triggered by S9 or timed by the S11 rate. Replies with the
+/// most scans per second the channel profiles allow
+///
+///	\return TRUE success. FALSE the ADC is off, bad mask or bad mode
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_ScanStart(ListOfParameterStructureType *source)
+{
+	ADCScanModeType Mode = ADCScanMode_Continuous;
+	int32_t MaxRate;
+
+	if ( source->NumberOfParameter > 2 )
+	{
+		if ( source->List[2].Value < 0 || source->List[2].Value > ADCScanMode_Timer )
+		{
+			return FALSE;
+		}
+
+		Mode = (ADCScanModeType)source->List[2].Value;
+	}
+
+	if ( TRUE != ADC_Scan_Start((uint32_t)source->List[1].Value, Mode) )
+	{
+		return FALSE;
+	}
+
+	MaxRate = (int32_t)ADC_ReturnMaxScanRate((uint32_t)source->List[1].Value);
+	SendReply(&MaxRate, 1);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S8 command. Stop the scan
+///
+///	\return TRUE success
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_ScanStop(ListOfParameterStructureType *source)
+{
+	(void)source;
+
+	ADC_Scan_Stop();
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S9 command. Start one scan in the triggered mode
+///
+///	\return TRUE success. FALSE no scan or still converting
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_ScanTrigger(ListOfParameterStructureType *source)
+{
+	(void)source;
+
+	return ADC_Scan_Trigger();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S10 command. Send the last complete scan vector
+///
+///	\return TRUE success. FALSE no vector yet
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_ScanLatest(ListOfParameterStructureType *source)
+{
+	uint16_t Vector[ADC_NUMBER_OF_CHANNELS];
+	int32_t Reply[ADC_NUMBER_OF_CHANNELS];
+	uint32_t Count;
+	uint32_t Index;
+
+	(void)source;
+
+	Count = ADC_Scan_GetLatest(&Vector[0]);
+
+	for ( Index = 0; Index < Count; Index++ )
+	{
+		Reply[Index] = Vector[Index];
+	}
+
+	SendReply(&Reply[0], Count);
+
+	return Count ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S11 command. Set the timer mode rate to U0 scans per second.
+/// Replies with the requested rate and the rate achieved in millihertz
+///
+///	\return TRUE success. FALSE rate out of range
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_ScanRate(ListOfParameterStructureType *source)
+{
+	int32_t Reply[2];
+
+	Reply[0] = source->List[1].Value;
+	Reply[1] = (int32_t)ADC_Scan_SetRate((uint32_t)source->List[1].Value);
+	SendReply(&Reply[0], 2);
+
+	return Reply[1] ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief wait for the S12 conversion and send the supply compensated
+/// temperature in centi-degrees and the supply in millivolts
+///
+///	\return TRUE sent. FALSE failed. COMMAND_PENDING still converting
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t PollTemperature(void)
+{
+	uint16_t Samples[ADC_MAX_CONVERSION_CHANNELS];
+	int32_t Reply[2];
+	uint32_t SupplyFactor;
+	int_fast8_t Count;
+
+	Count = ADC_GetConversion(&Samples[0]);
+
+	if ( !Count )
+	{
+		return COMMAND_PENDING;
+	}
+
+	Timer_Cancel(&ConversionTimer);
+
+	if ( Count < 2 )
+	{
+		return FALSE;
+	}
+
+	// channel number order. The sensor then VREFINT
+	SupplyFactor = ADC_ReturnSupplyFactor(Samples[1]);
+
+	Reply[0] = ADC_ReturnCompensatedTemperature(Samples[0], SupplyFactor);
+	Reply[1] = (int32_t)ADC_ReturnSupplyMillivolts(SupplyFactor);
+	SendReply(&Reply[0], 2);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S12 command. Convert the temperature sensor and VREFINT in one
+/// scan. Replies once converted
+///
+///	\return COMMAND_PENDING started. FALSE the ADC is off or busy
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_Temperature(ListOfParameterStructureType *source)
+{
+	(void)source;
+
+	if ( TRUE != ADC_Convert(((uint32_t)1 << ADC_TEMPERATURE_CHANNEL) | ((uint32_t)1 << ADC_VREFINT_CHANNEL), 0) )
+	{
+		return FALSE;
+	}
+
+	Timer_Start(&ConversionTimer, TERMINAL_CONVERSION_TIMEOUT_MS, 0, ConversionTimedOut, 0);
+	PendingCommand = PollTemperature;
+	return COMMAND_PENDING;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S13 command. Stream the scan decimated by 2 to the power of U0.
+/// Without U0 the stream stops
+///
+///	\return TRUE success. FALSE ratio too large
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_Decimate(ListOfParameterStructureType *source)
+{
+	if ( source->NumberOfParameter < 2 )
+	{
+		Decimator_Stop();
+		return TRUE;
+	}
+
+	if ( source->List[1].Value < 0 )
+	{
+		return FALSE;
+	}
+
+	return Decimator_Start((uint32_t)source->List[1].Value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S14 command. Raise an alarm when ADC channel U0 goes outside the
+/// U1 to U2 sample window. It clears once back inside by U3. Without U0 the
+/// alarm is turned off. Alarm changes are sent without being asked for.
+///
+///	\return TRUE success. FALSE missing or bad parameters
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_Alarm(ListOfParameterStructureType *source)
+{
+	if ( source->NumberOfParameter < 2 )
+	{
+		ADC_Watchdog_Stop();
+		return TRUE;
+	}
+
+	if ( source->NumberOfParameter < 5 || source->List[1].Value < 0 || source->List[2].Value < 0 ||
+		source->List[3].Value < 0 || source->List[4].Value < 0 )
+	{
+		return FALSE;
+	}
+
+	return ADC_Watchdog_Start((uint32_t)source->List[1].Value, (uint32_t)source->List[2].Value,
+							(uint32_t)source->List[3].Value, (uint32_t)source->List[4].Value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S15 command. Set how ADC channel U0 is converted from the next
+/// scan or sample. U1 is the sampling time, 0 = 1.5 to 7 = 239.5 clocks.
+/// Without U1 the profile is only reported. Replies with the profile and the
+/// most samples per second of the channel on its own
+///
+///	\return TRUE success. FALSE bad channel or profile
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_Profile(ListOfParameterStructureType *source)
+{
+	ADCProfileType Profile;
+	int32_t Reply[4];
+	int32_t Bits;
+
+	if ( source->List[1].Value < 0 || TRUE != ADC_GetProfile((uint32_t)source->List[1].Value, &Profile) )
+	{
+		return FALSE;
+	}
+
+	if ( source->NumberOfParameter > 2 )
+	{
+		if ( source->List[2].Value < ADCSampleTime_1_5 || source->List[2].Value > ADCSampleTime_239_5 )
+		{
+			return FALSE;
+		}
+
+		Profile.SampleTime = (ADCSampleTimeType)source->List[2].Value;
+		Profile.Resolution = ADCResolution_12Bit;
+		Profile.Alignment = ADCAlign_Right;
+
+		if ( source->NumberOfParameter > 3 )
+		{
+			Bits = source->List[3].Value;
+
+			if ( Bits < 6 || Bits > 12 || (Bits & 1) )
+			{
+				return FALSE;
+			}
+
+			Profile.Resolution = (ADCResolutionType)((12 - Bits) / 2);
+		}
+
+		if ( source->NumberOfParameter > 4 && source->List[4].Value )
+		{
+			Profile.Alignment = ADCAlign_Left;
+		}
+
+		if ( TRUE != ADC_SetProfile((uint32_t)source->List[1].Value, &Profile) )
+		{
+			return FALSE;
+		}
+	}
+
+	Reply[0] = Profile.SampleTime;
+	Reply[1] = 12 - (Profile.Resolution * 2);
+	Reply[2] = Profile.Alignment;
+	Reply[3] = (int32_t)ADC_ReturnMaxScanRate((uint32_t)1 << source->List[1].Value);
+	SendReply(&Reply[0], 4);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S16 command. Capture the scan around a trigger on the channel at
+/// position U0 of the scan vector. Without U0 only the state is reported.
+/// Replies with the capture state and the buffer size in samples.
+///
+///	\return TRUE success. FALSE missing or bad parameters, no scan or the
+///	last capture is still being sent
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_Capture(ListOfParameterStructureType *source)
+{
+	int32_t Reply[2];
+	uint32_t Index;
+
+	if ( source->NumberOfParameter > 1 )
+	{
+		if ( source->NumberOfParameter < 6 || CaptureSending )
+		{
+			return FALSE;
+		}
+
+		for ( Index = 1; Index < 6; Index++ )
+		{
+			if ( source->List[Index].Value < 0 )
+			{
+				return FALSE;
+			}
+		}
+
+		if ( TRUE != Capture_Arm((uint32_t)source->List[1].Value, (CaptureTriggerType)source->List[2].Value,
+								(uint32_t)source->List[3].Value, (uint32_t)source->List[4].Value, (uint32_t)source->List[5].Value) )
+		{
+			return FALSE;
+		}
+	}
+
+	Reply[0] = (int32_t)Capture_GetState();
+	Reply[1] = (int32_t)Capture_GetBufferSize();
+	SendReply(&Reply[0], 2);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S17 command. Send the frozen capture in one go. An unsolicited S17
+/// frame with the vector count, channel count, trigger vector, timestamp,
+/// byte count, CRC-32 of the data and the timestamp in micro-seconds, low
+/// then high word, comes first. Then the samples as raw
+/// little endian 16 bit words, not framed, and then the S17 reply.
+///
+///	\return TRUE sent. FALSE not in binary mode, nothing captured, no room
+///	for the header or no transmit descriptor free for the samples. The
+///	header and the samples are queued together or not at all, since the
+///	host needs the header to find the end of the samples
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_CaptureRead(ListOfParameterStructureType *source)
+{
+	CaptureType Capture;
+	int32_t Header[8];
+	uint32_t Length;
+
+	(void)source;
+
+	if ( TerminalMode_Binary != TerminalMode || TRUE != Capture_Get(&Capture) )
+	{
+		return FALSE;
+	}
+
+	Length = Capture.NumberOfVectors * Capture.NumberOfChannels * sizeof(uint16_t);
+
+	Header[0] = (int32_t)Capture.NumberOfVectors;
+	Header[1] = (int32_t)Capture.NumberOfChannels;
+	Header[2] = (int32_t)Capture.TriggerVector;
+	Header[3] = (int32_t)Capture.TimestampMs;
+	Header[4] = (int32_t)Length;
+	Header[5] = (int32_t)CRC32_Calculate((const uint8_t *)Capture.Samples, Length);
+	Header[6] = (int32_t)(uint32_t)Capture.TimestampUs;
+	Header[7] = (int32_t)(uint32_t)(Capture.TimestampUs >> 32);
+
+	// the header may take a descriptor of its own and the samples need
+	// another. Queue neither unless both fit, so the host never gets a
+	// header without its samples
+	if ( SerialPort2.GetTransmitFreeDescriptors() < 2 ||
+		TRUE != SendStream(CommandIndex_Command_CaptureRead + 1, &Header[0], 8) )
+	{
+		return FALSE;
+	}
+
+	if ( TRUE != SerialPort2.SendArrayInPlace((const uint8_t *)Capture.Samples, Length) )
+	{
+		return FALSE;
+	}
+
+	CaptureSending = TRUE;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S18 command. Clear the temperature history and fill it from the
+/// scan, one sample per 2 to the power of U0 vectors. Without U0 it stops
+/// filling.
+///
+///	\return TRUE success. FALSE ratio too large
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_History(ListOfParameterStructureType *source)
+{
+	if ( source->NumberOfParameter < 2 )
+	{
+		History_Stop();
+		return TRUE;
+	}
+
+	if ( source->List[1].Value < 0 )
+	{
+		return FALSE;
+	}
+
+	return History_Start((uint32_t)source->List[1].Value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S19 command. Send the statistics of the newest U0 history samples.
+/// Replies with the sample count, mean, minimum, maximum, standard deviation
+/// and newest sample, in centi-degrees
+///
+///	\return TRUE success. FALSE bad window or no samples yet
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_HistoryStats(ListOfParameterStructureType *source)
+{
+	HistoryStatsType Stats;
+	int32_t Reply[6];
+
+	if ( source->List[1].Value < 0 || TRUE != History_GetStats((uint32_t)source->List[1].Value, &Stats) )
+	{
+		return FALSE;
+	}
+
+	Reply[0] = (int32_t)Stats.NumberOfSamples;
+	Reply[1] = Stats.Mean;
+	Reply[2] = Stats.Minimum;
+	Reply[3] = Stats.Maximum;
+	Reply[4] = Stats.StandardDeviation;
+	Reply[5] = Stats.Latest;
+	SendReply(&Reply[0], 6);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief S20 command. Report ADC channel U0 of the scan only when it moves
+/// by more than U1 counts, or at least every U2 ms. Without U1 the channel
+/// stops being reported and without U0 every channel does.
+///
+///	\return TRUE success. FALSE bad parameters
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t Command_Exception(ListOfParameterStructureType *source)
+{
+	uint32_t HeartbeatMs = 0;
+
+	if ( source->NumberOfParameter < 2 )
+	{
+		Stream_Stop();
+		return TRUE;
+	}
+
+	if ( source->List[1].Value < 0 )
+	{
+		return FALSE;
+	}
+
+	if ( source->NumberOfParameter < 3 )
+	{
+		Stream_ClearChannel((uint32_t)source->List[1].Value);
+		return TRUE;
+	}
+
+	if ( source->NumberOfParameter > 3 )
+	{
+		if ( source->List[3].Value < 0 )
+		{
+			return FALSE;
+		}
+
+		HeartbeatMs = (uint32_t)source->List[3].Value;
+	}
+
+	if ( source->List[2].Value < 0 )
+	{
+		return FALSE;
+	}
+
+	return Stream_SetChannel((uint32_t)source->List[1].Value, (uint32_t)source->List[2].Value, HeartbeatMs);
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief this message has the system information data that we want to display
-/// on the terminal
+/// \brief S21 command. Sample ADC channel U0 of the scan U1 times a second.
+/// Without U1 the channel is unsubscribed and without U0 every channel is.
+/// The samples are streamed as [sequence, ms, channel, value...]
+///
+///	\return TRUE success. FALSE bad parameters
 ///////////////////////////////////////////////////////////////////////////////
-static const uint8_t SystemMessageString[] = "-----------------------------------\r\n"
-											"Firm : " FIRMWARE_VERSION "\r\n"
-											"Hard : " HARDWARE_VERSION "\r\n"
-											COMPILED_DATA_TIME "\r\n"
-											"-----------------------------------\r\n"
-											"S1 - LED Control: U0 = led state\r\n"
-											"S2 - ADC On\r\n"
-											"S3 - ADC Off\r\n"
-											"S4 - ADC Sample: U0 = channel\r\n";
+static int_fast8_t Command_Subscribe(ListOfParameterStructureType *source)
+{
+	if ( source->NumberOfParameter < 2 )
+	{
+		Stream_UnsubscribeAll();
+		return TRUE;
+	}
+
+	if ( source->List[1].Value < 0 )
+	{
+		return FALSE;
+	}
+
+	if ( source->NumberOfParameter < 3 )
+	{
+		Stream_Unsubscribe((uint32_t)source->List[1].Value);
+		return TRUE;
+	}
+
+	if ( source->List[2].Value < 0 )
+	{
+		return FALSE;
+	}
+
+	return Stream_Subscribe((uint32_t)source->List[1].Value, (uint32_t)source->List[2].Value);
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief Defines the parameter data type
+/// \brief S22 command. Send the counts of data lost because it wasn't taken
+/// in time
+///
+///	\return TRUE
 ///////////////////////////////////////////////////////////////////////////////
-typedef union {
-	struct{
-		uint8_t Type;			///< Parameter data type. S = command, U = integer
-		DataConverter Value;	///< parameter data
-	};
-	uint8_t StringArray[PARAMETER_STRING_SIZE];	///< Data string format. Note the first character is the command
-} ParamStructureType;
+static int_fast8_t Command_Status(ListOfParameterStructureType *source)
+{
+	int32_t Reply[2];
+
+	(void)source;
+
+	Reply[0] = (int32_t)SerialPort2.GetReceiveOverflowCount();
+	Reply[1] = (int32_t)Decimator_GetOverflowCount();
+	SendReply(&Reply[0], 2);
+
+	return TRUE;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief Defines the list of parameter data structure
+/// \brief Defines a command table entry
 ///////////////////////////////////////////////////////////////////////////////
 typedef struct {
+	int_fast8_t (*Handler)(ListOfParameterStructureType *source);	///< runs the command
+	const char *ParameterTypes;										///< one lower case type letter per parameter
+	uint8_t MinimumParameters;										///< number of parameters that must be given
+} CommandType;
 
-	uint32_t NumberOfParameter;		///< used to keep track of the number of parameter we haver
-	ParamStructureType List[MAX_NUMBER_OF_PARAMETERS];	///< hold the parameter
-} ListOfParameterStructureType;
+///////////////////////////////////////////////////////////////////////////////
+/// \brief the command table. Indexed by the command number - 1
+///
+///	\sa TERMINAL_COMMAND_LIST
+///////////////////////////////////////////////////////////////////////////////
+static const CommandType CommandTable[NUMBER_OF_COMMANDS] = {
+	TERMINAL_COMMAND_LIST(COMMAND_ENTRY)
+};
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief holds our current list of parameter extracted by ProcessData
+/// \brief run the terminal command
 ///
-///	\sa ProcessData
+///	\return TRUE success. FALSE undefined command, the parameters don't match
+///	the command or the command failed. COMMAND_PENDING the command finishes
+///	later
 ///////////////////////////////////////////////////////////////////////////////
-static ListOfParameterStructureType ParameterList;
+static int_fast8_t RunCommand(ListOfParameterStructureType *source)
+{
+	const CommandType *Command;
+	uint32_t NumberOfArguments;
+	uint32_t Index;
+
+	// the S number selects the table entry directly
+	Index = (uint32_t)source->List[0].Value - 1;
+
+	if ( 's' != source->List[0].Type || Index >= NUMBER_OF_COMMANDS )
+	{
+		// undefined command
+		return FALSE;
+	}
+
+	Command = &CommandTable[Index];
+
+	// the command itself is the first parameter
+	NumberOfArguments = source->NumberOfParameter - 1;
+
+	if ( NumberOfArguments < Command->MinimumParameters || NumberOfArguments > strlen(Command->ParameterTypes) )
+	{
+		return FALSE;
+	}
+
+	for ( Index = 0; Index < NumberOfArguments; Index++ )
+	{
+		if ( source->List[Index + 1].Type != (uint8_t)Command->ParameterTypes[Index] )
+		{
+			return FALSE;
+		}
+	}
 
+	return Command->Handler(source);
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief Send the system information to the computer. This first clear the
-///	computer terminal screen.
+/// \brief run the command in ParameterList. Used by both modes.
+///
+///	\return TRUE success. FALSE the command failed. COMMAND_PENDING the
+///	command finishes later
 ///////////////////////////////////////////////////////////////////////////////
-static void DisplaySystemInformation(void)
+static int_fast8_t ExecuteCommand(void)
 {
-	SerialPort2.SendByte(0x0C); // clear terminal
-    SerialPort2.SendString(&SystemMessageString[0]);
-	// Send new line feed and prompt
-	SerialPort2.SendString((uint8_t*)"\n> ");
+	CommandNumber = (uint8_t)ParameterList.List[0].Value;
+
+	if ( BaudrateState_ConfirmPending == BaudrateState )
+	{
+		// a valid command at the new rate confirms the change
+		Timer_Cancel(&BaudrateConfirmTimer);
+		CurrentBaudrate = NewBaudrate;
+		BaudrateState = BaudrateState_Idle;
+	}
+
+	NumberOfReplyValues = 0;
+
+	return RunCommand(&ParameterList);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief Init the terminal program
+/// \brief change to the mode selected by the last command
 ///////////////////////////////////////////////////////////////////////////////
-void Terminal_Init(void)
+static void ApplyTerminalMode(void)
 {
-    Led_Init();
-    Tick_init();
-    SerialPort2.Open(115200);
+	TerminalMode = NewTerminalMode;
 
-    NumberOfByteReceived = 0;
-    DisplaySystemInformation();
+	FrameLength = 0;
+	ParserReset();
+
+	if ( TerminalMode_Ascii == TerminalMode )
+	{
+		SerialPort2.SendString((uint8_t*)"\n\r> ");
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief process the buffer data and extract the commands
-///
-///	\return TRUE success
+/// \brief the command is done. Send the binary reply frame or the ASCII
+/// prompt and make any mode change the command asked for
 ///
-///	\todo update the document return state value. need to implement
+///	\param result the command result
 ///////////////////////////////////////////////////////////////////////////////
-static int_fast8_t ProcessData(uint8_t *source, uint32_t length, ListOfParameterStructureType * destination)
+static void FinishCommand(int_fast8_t result)
 {
-	uint32_t ParameterCharacterLength = 0;
-	uint32_t ParameterCounter = 0;
-	uint8_t *CurrentParamStrPointer;
+	PendingCommand = 0;
 
-	// checking the pointer aren't null
-	if ( !source || !destination)
+	if ( TerminalMode_Binary == TerminalMode )
 	{
-		destination->NumberOfParameter = 0; // reset the number of parameters
-		return ERROR;
+		SendFrame(CommandNumber, CommandSequence, result, &ReplyValues[0], NumberOfReplyValues);
 	}
 
-	destination->NumberOfParameter = 0; // reset
-	CurrentParamStrPointer = &destination->List[destination->NumberOfParameter].StringArray[0];
-
-	for( ; length ; length--)
+	if ( NewTerminalMode != TerminalMode )
 	{
+		ApplyTerminalMode();
+	}
+	else if ( TerminalMode_Ascii == TerminalMode )
+	{
+		// Send new line feed and prompt
+		SerialPort2.SendString((uint8_t*)"\n\r> ");
+	}
+}
 
-		if ( *source  == ' ')
-		{
-			destination->NumberOfParameter++;
-
-			if (destination->NumberOfParameter < MAX_NUMBER_OF_PARAMETERS )
-			{
-				CurrentParamStrPointer = &destination->List[destination->NumberOfParameter].StringArray[0];
-			}
-			else
-			{
-				destination->NumberOfParameter = 0; // reset the number of parameters
-				return FALSE;
-			}
-
-			ParameterCharacterLength = 0;
-
-		}
-		else
-		{
-
-			if ( ParameterCharacterLength < (PARAMETER_STRING_SIZE -1) )
-			{
+///////////////////////////////////////////////////////////////////////////////
+/// \brief check and run the binary command frame in FrameBuffer
+///
+///	\param length the encoded frame length
+///
+///	\return TRUE a command was run successfully. FALSE bad frame or the
+///	command failed. COMMAND_PENDING the command finishes later
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t ProcessFrame(uint32_t length)
+{
+	const char *ParameterTypes = "";
+	uint32_t NumberOfArguments;
+	uint32_t Index;
+	int_fast8_t Result;
 
-				*CurrentParamStrPointer = *source;
-				CurrentParamStrPointer++;
-				*CurrentParamStrPointer = 0;
-				ParameterCharacterLength++;
-			}
-		}
+	length = COBS_Decode(&FrameBuffer[0], length, &FrameBuffer[0]);
 
-		source++;
+	if ( length < (FRAME_COMMAND_HEADER_SIZE + FRAME_CRC_SIZE) ||
+		(length - FRAME_COMMAND_HEADER_SIZE - FRAME_CRC_SIZE) % 4 )
+	{
+		return FALSE;
 	}
 
+	length -= FRAME_CRC_SIZE;
 
-	if (ParameterCharacterLength >= 2)
+	if ( CRC32_Calculate(&FrameBuffer[0], length) != ReadLittleEndian32(&FrameBuffer[length]) )
 	{
-		destination->NumberOfParameter++;
+		return FALSE;
 	}
-	else if ( !destination->NumberOfParameter )
+
+	NumberOfArguments = (length - FRAME_COMMAND_HEADER_SIZE) / 4;
+
+	if ( NumberOfArguments >= MAX_NUMBER_OF_PARAMETERS )
 	{
-		destination->NumberOfParameter = 0;
 		return FALSE;
-	} else if ( 's' == !destination->List[0].Type && 'S' == !destination->List[0].Type)
-	{
-		destination->NumberOfParameter = 0;
-		return ERROR;
 	}
 
+	// the record layout is fixed by the command so the types come from the table
+	if ( FrameBuffer[0] && FrameBuffer[0] <= NUMBER_OF_COMMANDS )
+	{
+		ParameterTypes = CommandTable[FrameBuffer[0] - 1].ParameterTypes;
+	}
 
+	ParameterList.List[0].Type = 's';
+	ParameterList.List[0].Value = FrameBuffer[0];
 
-	// We have a valid number of parameters
-	for(ParameterCounter = 0; ParameterCounter < destination->NumberOfParameter ; ParameterCounter++)
+	for ( Index = 0; Index < NumberOfArguments; Index++ )
 	{
+		// RunCommand rejects any argument beyond the command's list
+		ParameterList.List[Index + 1].Type = (Index < strlen(ParameterTypes)) ? (uint8_t)ParameterTypes[Index] : 'u';
+		ParameterList.List[Index + 1].Value = (int32_t)ReadLittleEndian32(&FrameBuffer[FRAME_COMMAND_HEADER_SIZE + (Index * 4)]);
+	}
 
-		switch (destination->List[ParameterCounter].Type)
-		{
-		case 'S':
-			/// \fallthrough
-		case 'U':
-			/// \fallthrough
-			destination->List[ParameterCounter].Type += 32; // convert to uppercase
-		case 's':
-			/// \fallthrough
-		case 'u':
-			destination->List[ParameterCounter].Value.i32_t[0] = atoi((char *) &destination->List[ParameterCounter].StringArray[1]);
-			break;
+	ParameterList.NumberOfParameter = NumberOfArguments + 1;
+	CommandSequence = FrameBuffer[1];
 
-		case 'F':
-			/// \fallthrough
-		case 'f':
-			destination->List[ParameterCounter].Value.f32_t[0] = atof((char *) &destination->List[ParameterCounter].StringArray[1]);
-			break;
+	Result = ExecuteCommand();
 
+	if ( COMMAND_PENDING != Result )
+	{
+		FinishCommand(Result);
+	}
 
-		case 'T':
-			/// \fallthrough
-			destination->List[ParameterCounter].Type += 32; // convert to uppercase
-		case 't':
-			// don't need to do anything its already converted
-			break;
+	return Result;
+}
 
-		default:
-			destination->NumberOfParameter = 0;
-			return ERROR;
-			break;
+///////////////////////////////////////////////////////////////////////////////
+/// \brief add a single received byte to the binary frame and run the command
+/// once the zero delimiter is received. A frame that is too long is dropped
+/// and we are back in step at the next zero.
+///
+///	\param data the received byte
+///
+///	\return TRUE a command was run successfully. FALSE no command or it failed.
+///	COMMAND_PENDING the command finishes later
+///////////////////////////////////////////////////////////////////////////////
+static int_fast8_t ProcessFrameByte(uint8_t data)
+{
+	uint32_t Length;
 
+	if ( data )
+	{
+		if ( FrameLength < FRAME_RECEIVE_BUFFER_SIZE )
+		{
+			FrameBuffer[FrameLength] = data;
 		}
-	}
 
+		if ( FrameLength <= FRAME_RECEIVE_BUFFER_SIZE )
+		{
+			FrameLength++;
+		}
 
+		return FALSE;
+	}
 
+	Length = FrameLength;
+	FrameLength = 0;
 
+	if ( !Length || Length > FRAME_RECEIVE_BUFFER_SIZE )
+	{
+		// empty or too long
+		return FALSE;
+	}
 
-	return TRUE;
+	return ProcessFrame(Length);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief run the terminal command
+/// \brief add a single received byte to the command buffer and run the
+/// command once the carriage return is received.
 ///
-///	\return TRUE success
+///	\param SerialTempData the received byte
 ///
-///	\todo update the document return state value. need to implement
+///	\return TRUE a command was run successfully. FALSE no command or it failed.
+///	COMMAND_PENDING the command finishes later
 ///////////////////////////////////////////////////////////////////////////////
-static int_fast8_t RunCommand(ListOfParameterStructureType *source)
+static int_fast8_t ProcessByte(uint8_t SerialTempData)
 {
-	uint_fast16_t ADCSample;
-	float Temperature;
-	float ADCSampleNorm = 0;
-	uint8_t Message[50];
+	int_fast8_t Result = FALSE;
+
+	if ('\r' == SerialTempData)
+	{
+		SerialPort2.SendString((uint8_t*)"\n\r");
+
+		if ( TRUE == ParserEndCommand() )
+		{
+			Result = ExecuteCommand();
+		}
 
-	enum{
-		Command_LEDControl = 1,
-		Command_ADCOn,
-		Command_ADCOff,
-		Command_ADCSample,
-	};
+		ParserReset();
 
-	switch ( source->List[0].Value.i32_t[0] )
+		if ( COMMAND_PENDING != Result )
+		{
+			FinishCommand(Result);
+		}
+	}
+	else if ( (SerialTempData >= '0' && SerialTempData <= '9') ||
+			(SerialTempData >= 'A' && SerialTempData <= 'Z') ||
+			(SerialTempData >= 'a' && SerialTempData <= 'z') ||
+			' ' == SerialTempData || '.' == SerialTempData || '-' == SerialTempData)
+	{
+		ParserFeed(SerialTempData);
+	}
+	else
 	{
-		case Command_LEDControl: // control the LED
+		// any other character starts the command again
+		ParserReset();
+	}
 
-			if ( source->NumberOfParameter > 1 && source->List[1].Type == 'u')
-			{
-				if ( source->List[1].Value.i32_t[0] )
-				{
-					Led_On();
-				}
-				else
-				{
-					Led_Off();
-				}
+	return Result;
+}
 
-			}
-			else
-			{
-				Led_Toggle();
-			}
-			break;
-		case Command_ADCOn:
-			ADC_On();
-			break;
+///////////////////////////////////////////////////////////////////////////////
+/// \brief send any streamed data that is ready
+///////////////////////////////////////////////////////////////////////////////
+static void ProcessStreams(void)
+{
+	DecimatorOutputType Decimated;
+	StreamSampleType Sample;
+	StreamBatchType Batch;
+	ADCAlarmType Alarm;
+	int32_t Values[ADC_NUMBER_OF_CHANNELS + 1];
+	uint32_t Index;
+
+	if ( CaptureSending && !SerialPort2.IsTransmitBusy() )
+	{
+		CaptureSending = FALSE;
+	}
 
-		case Command_ADCOff:
-			ADC_Off();
-			break;
+	if ( BaudrateState_Idle != BaudrateState )
+	{
+		// hold the stream while the baudrate changes. Let the transmit drain
+		return;
+	}
 
-		case Command_ADCSample:
-			if ( source->NumberOfParameter > 1 && source->List[1].Type == 'u')
-			{
-				ADC_Read(source->List[1].Value.ui32_t[0] , &ADCSample);
+	ADC_Watchdog_GetAlarm(&Alarm);
 
-				Temperature =  ADC_ReturnCalibratedTemperature(ADCSample);
+	if ( Alarm.ChangeCount != AlarmChangeCount )
+	{
+		AlarmChangeCount = Alarm.ChangeCount;
 
-				ADC_ReadNorm(source->List[1].Value.ui32_t[0], &ADCSampleNorm);
+		Values[0] = (int32_t)Alarm.TimestampMs;
+		Values[1] = (int32_t)Alarm.State;
+		Values[2] = (int32_t)Alarm.ChangeCount;
+		SendStream(CommandIndex_Command_Alarm + 1, &Values[0], 3);
+	}
 
-				snprintf(&Message[0], 50, "%d\t%d\t%d\n\r", ADCSample, ((uint32_t)Temperature*100), (uint32_t)(ADCSampleNorm*1000000));
+	// an output not taken stays queued, so only take what can be sent. The
+	// decimator counts the outputs it has to drop when its queue is full
+	while ( SerialPort2.GetTransmitFreeSpace() >= TERMINAL_DECIMATE_MIN_FREE && TRUE == Decimator_Read(&Decimated) )
+	{
+		Values[0] = (int32_t)Decimated.TimestampMs;
 
-				// Send new line feed and prompt
-				SerialPort2.SendString(&Message[0]);
+		for ( Index = 0; Index < Decimated.NumberOfValues; Index++ )
+		{
+			Values[Index + 1] = (int32_t)Decimated.Values[Index];
+		}
 
-			}
-			break;
-		default:
-			// undefined command
-			return FALSE;
-			break;
+		SendStream(CommandIndex_Command_Decimate + 1, &Values[0], Decimated.NumberOfValues + 1);
+	}
 
+	// a sample not taken stays due, so only take what can be sent
+	while ( SerialPort2.GetTransmitFreeSpace() >= TERMINAL_STREAM_MIN_FREE && TRUE == Stream_Read(&Sample) )
+	{
+		Values[0] = (int32_t)Sample.TimestampMs;
+		Values[1] = (int32_t)Sample.Channel;
+		Values[2] = (int32_t)Sample.Value;
+		SendStream(CommandIndex_Command_Exception + 1, &Values[0], 3);
 	}
 
-	return TRUE;
+	// a batch that doesn't fit is dropped. The host sees the sequence gap
+	while ( TRUE == Stream_ReadBatch(&Batch) )
+	{
+		if ( SerialPort2.GetTransmitFreeSpace() < TERMINAL_BATCH_MIN_FREE )
+		{
+			continue;
+		}
+
+		Values[0] = (int32_t)Batch.Sequence;
+		Values[1] = (int32_t)Batch.TimestampMs;
+
+		for ( Index = 0; Index < Batch.NumberOfSamples; Index++ )
+		{
+			Values[(Index * 2) + 2] = (int32_t)Batch.Channel[Index];
+			Values[(Index * 2) + 3] = (int32_t)Batch.Value[Index];
+		}
+
+		SendStream(CommandIndex_Command_Subscribe + 1, &Values[0], (Batch.NumberOfSamples * 2) + 2);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// \brief process the buffer data and extract the commands
+/// \brief return how long the core can sleep. The receive and the transmit
+/// interrupts wake it, but the end of the transmit and the pending commands
+/// are polled, so those are checked every tick.
 ///
-///	\return TRUE success. FALSE no error
+///	\return 0 = received data, or a decimator or alarm output, to process.
+///	1 = polling. TICK_IDLE_FOREVER = waiting on the host
+///////////////////////////////////////////////////////////////////////////////
+uint32_t Terminal_GetIdleMs(void)
+{
+	ADCAlarmType Alarm;
+
+	if ( SerialPort2.DoesReceiveBufferHaveData() )
+	{
+		return PendingCommand ? 1 : 0;
+	}
+
+	if ( PendingCommand || CaptureSending || BaudrateState_SwitchPending == BaudrateState )
+	{
+		return 1;
+	}
+
+	ADC_Watchdog_GetAlarm(&Alarm);
+
+	// made by the block handler or the watchdog since the last pass. The
+	// stream holds them while the baudrate changes, and the decimator's
+	// until there is room to send them. The transmit interrupt wakes us.
+	if ( BaudrateState_Idle == BaudrateState && (Alarm.ChangeCount != AlarmChangeCount ||
+		(TRUE == Decimator_IsOutputPending() && SerialPort2.GetTransmitFreeSpace() >= TERMINAL_DECIMATE_MIN_FREE)) )
+	{
+		return 0;
+	}
+
+	return TICK_IDLE_FOREVER;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief read the pending serial data in blocks and run any complete
+/// command. In ASCII mode the data is echoed back. Nothing more is read
+/// while a command is waiting to finish.
 ///
-///	\todo update the document return state value. need to implement
+///	\return TRUE a command was run successfully. FALSE no error
 ///////////////////////////////////////////////////////////////////////////////
 int_fast8_t Terminal_Process(void)
 {
-	uint8_t SerialTempData = 0; // hold the new byte from the serial fifo
+	uint32_t EchoStart;
 	int_fast8_t Result = FALSE;
+	int_fast8_t CommandResult;
 
-	Result = SerialPort2.GetByte(&SerialTempData);
+	ProcessBaudrateChange();
+	ProcessStreams();
 
-	if ( TRUE != Result )
+	if ( PendingCommand )
 	{
-		return Result;
-	}
+		CommandResult = PendingCommand();
+
+		if ( COMMAND_PENDING == CommandResult )
+		{
+			return FALSE;
+		}
 
-	// echo the user command
-	SerialPort2.SendByte(SerialTempData);
+		FinishCommand(CommandResult);
+		Result = CommandResult;
+	}
 
-	if ('\r' == SerialTempData)
+	if ( ReadIndex >= ReadCount )
 	{
-		SerialPort2.SendString((uint8_t*)"\n\r");
+		ReadCount = SerialPort2.GetArray(&ReadBuffer[0], TERMINAL_READ_BLOCK_SIZE);
+		ReadIndex = 0;
+	}
 
-		if (NumberOfByteReceived)
-		{
-			/// \todo call the process data
-			if ( TRUE == ProcessData(&Buffer[0], NumberOfByteReceived, &ParameterList) )
-			{
-				if(  TRUE == RunCommand(&ParameterList) )
-				{
-					Result =  TRUE;
-				}
+	EchoStart = ReadIndex;
 
-			}
+	while ( ReadIndex < ReadCount && !PendingCommand )
+	{
+		if ( TerminalMode_Binary == TerminalMode )
+		{
+			// frames are never echoed
+			CommandResult = ProcessFrameByte(ReadBuffer[ReadIndex++]);
+			EchoStart = ReadIndex;
 		}
 		else
 		{
-			Result =  FALSE;
+			if ('\r' == ReadBuffer[ReadIndex])
+			{
+				// echo the user command up to the carriage return before the command reply
+				SerialPort2.SendArray(&ReadBuffer[EchoStart], (ReadIndex + 1) - EchoStart);
+				EchoStart = ReadIndex + 1;
+			}
+
+			CommandResult = ProcessByte(ReadBuffer[ReadIndex++]);
 		}
-		// Send new line feed and prompt
-		SerialPort2.SendString((uint8_t*)"\n\r> ");
-	}
-	else if ( (SerialTempData >= '0' && SerialTempData <= '9') ||
-			(SerialTempData >= 'A' && SerialTempData <= 'Z') ||
-			(SerialTempData >= 'a' && SerialTempData <= 'z') || ' ' == SerialTempData || '.' == SerialTempData)
 
-	{
-		if ( NumberOfByteReceived < TERMINAL_BUFFER_SIZE )
+		if ( TRUE == CommandResult )
 		{
-			Buffer[NumberOfByteReceived] = SerialTempData;
-			NumberOfByteReceived++;
-			return FALSE;
+			Result = TRUE;
 		}
+	}
 
+	// echo the rest of the user command
+	if ( TerminalMode_Ascii == TerminalMode && EchoStart < ReadIndex )
+	{
+		SerialPort2.SendArray(&ReadBuffer[EchoStart], ReadIndex - EchoStart);
 	}
 
-	// reset buffer by reseting the counter
-	NumberOfByteReceived = 0;
 	return Result;
-
-
 }
 
 
@@ -6,18 +6,117 @@
 /////////////////////////////////////////////////////////////////////////
 #include "common.h"
 #include "Terminal.h"
+#include "MCU/adc.h"
+#include "MCU/timer.h"
+#include "MCU/event.h"
+#include "History.h"
+#include "Stream.h"
+#include "MCU/tick.h"
 
 
+/////////////////////////////////////////////////////////////////////////
+///	\brief serial data received, a transmit finished, or an ADC
+///	conversion finished or the alarm changed. The terminal takes it
+/////////////////////////////////////////////////////////////////////////
+static void TerminalEvent(void)
+{
+	Terminal_Process();
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief a scan block has been through the block handlers. Pick up what
+///	they queued
+/////////////////////////////////////////////////////////////////////////
+static void ScanEvent(void)
+{
+	History_Process();
+	Terminal_Process();
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief a tick passed. Run the timers and the terminal's timed streams
+/////////////////////////////////////////////////////////////////////////
+static void TickEvent(void)
+{
+	Timer_Process();
+	Terminal_Process();
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief a module is waiting on something that has no interrupt. Give
+///	every module a turn
+/////////////////////////////////////////////////////////////////////////
+static void PollEvent(void)
+{
+	Timer_Process();
+	ADC_Process();
+	History_Process();
+	Terminal_Process();
+}
+
+/////////////////////////////////////////////////////////////////////////
+///	\brief no event is waiting. Sleep until the next interrupt or the
+///	next deadline. The interrupts are disabled while checking, so an event
+///	posted after the check still wakes the core. A module that is polling
+///	keeps the core awake through Event_Poll.
+/////////////////////////////////////////////////////////////////////////
+static void Idle(void)
+{
+	uint32_t IdleMs;
+	uint32_t ModuleIdleMs;
+
+	__disable_irq();
+
+	if ( FALSE == Event_IsPending() )
+	{
+		IdleMs = ADC_GetIdleMs();
+
+		ModuleIdleMs = Terminal_GetIdleMs();
+		IdleMs = (ModuleIdleMs < IdleMs) ? ModuleIdleMs : IdleMs;
+
+		ModuleIdleMs = Timer_GetIdleMs();
+		IdleMs = (ModuleIdleMs < IdleMs) ? ModuleIdleMs : IdleMs;
+
+		ModuleIdleMs = Stream_GetIdleMs();
+		IdleMs = (ModuleIdleMs < IdleMs) ? ModuleIdleMs : IdleMs;
+
+		ModuleIdleMs = History_GetIdleMs();
+		IdleMs = (ModuleIdleMs < IdleMs) ? ModuleIdleMs : IdleMs;
+
+		if ( IdleMs )
+		{
+			Tick_Sleep(IdleMs);
+		}
+		else
+		{
+			Event_Post(Event_Poll);
+		}
+	}
+
+	__enable_irq();
+}
+
 /////////////////////////////////////////////////////////////////////////
 ///	\brief the first user code function to be called after the ARM M0
 ///	has initial.
 /////////////////////////////////////////////////////////////////////////
 void main(void)
 {
+    Event_Init();
+    Event_SetHandler(Event_Receive, TerminalEvent);
+    Event_SetHandler(Event_Transmit, TerminalEvent);
+    Event_SetHandler(Event_Conversion, TerminalEvent);
+    Event_SetHandler(Event_Scan, ScanEvent);
+    Event_SetHandler(Event_Tick, TickEvent);
+    Event_SetHandler(Event_Poll, PollEvent);
+
     Terminal_Init();
 
     for ( ;; )
     {
-    	Terminal_Process();
+    	if ( FALSE == Event_Dispatch() )
+    	{
+    		Idle();
+    	}
     }
 }